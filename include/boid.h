@@ -1,6 +1,8 @@
 #ifndef BOID_H
 #define BOID_H
 
+#include <stddef.h>
+
 #include "mvla.h"
 
 #include "rect.h"
@@ -8,12 +10,26 @@
 #define NEIGHBOURHOOD_WIDTH  (40.0)
 #define NEIGHBOURHOOD_HEIGHT (30.0)
 
+#define BOID_SOA_ALIGN (64) // byte alignment of every column
+
 /// A bird-oid object in the simulation, sitting at some position with some heading
 typedef struct boid {
   v2f_t position;
   v2f_t velocity;
 } boid_t;
 
+/// A population of boids stored column-wise (structure of arrays), so the same
+/// component of consecutive boids sits contiguously in memory
+typedef struct boid_soa {
+  size_t len;
+  // number of floats allocated per column, padded to a multiple of BOID_SOA_ALIGN
+  size_t capacity;
+  float *px;
+  float *py;
+  float *vx;
+  float *vy;
+} boid_soa_t;
+
 /// Construct a new boid from position and velocity
 boid_t boid_new(v2f_t position, v2f_t velocity);
 
@@ -23,4 +39,16 @@ float boid_sqr_distance(boid_t a, boid_t b);
 /// Get the neighbourhood of detection for this boid (centered around position)
 rect_t boid_neighbourhood(boid_t boid);
 
+/// Initialize BOID_SOA_ALIGN aligned columns large enough for len boids
+void boid_soa_init(boid_soa_t *soa, size_t len);
+
+/// Free the columns of a structure of arrays
+void boid_soa_free(boid_soa_t *soa);
+
+/// Transpose len boids into the columns of soa (which must have room for them)
+void boid_soa_load(boid_soa_t *soa, const boid_t *boids, size_t len);
+
+/// Store boid into the columns of soa at index i
+void boid_soa_store(boid_soa_t *soa, size_t i, boid_t boid);
+
 #endif // BOID_H
\ No newline at end of file
@@ -0,0 +1,160 @@
+#ifndef FQTREE_H
+#define FQTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mvla.h"
+
+#include "rect.h"
+#include "arena.h"
+#include "tpool.h"
+
+#define FQTREE_MAX_DEPTH (12) // deeper nodes are leaves, however full they are
+
+/// The function we inject to find where an element sits in the tree
+typedef v2f_t (*fqtree_point_fn_t)(void *ele);
+
+/// The function we inject to find the value summed into node aggregates
+typedef v2f_t (*fqtree_value_fn_t)(void *ele);
+
+/// Totals over a set of elements: how many, and the sums of their positions
+/// and values
+typedef struct fqtree_aggregate {
+  size_t count;
+  v2f_t points;
+  v2f_t values;
+} fqtree_aggregate_t;
+
+/// Sums over the elements of a node's subtree (its count being the node's len)
+typedef struct fqtree_sums {
+  v2f_t points;
+  v2f_t values;
+} fqtree_sums_t;
+
+/// A node of a flat quadtree; its whole subtree holds items[first..first+len],
+/// and unless it is a leaf (first_child == 0, the root is never a child) its
+/// children are nodes[first_child..first_child+4] in the order sw, se, nw, ne
+typedef struct fqtree_node {
+  uint32_t first_child;
+  uint32_t first;
+  uint32_t len;
+} fqtree_node_t;
+
+/// The run items[first..first+len] held by one leaf
+typedef struct fqtree_leaf {
+  uint32_t first;
+  uint32_t len;
+} fqtree_leaf_t;
+
+/// A quadtree linearised into one array of small nodes; a node's bounds are
+/// derived from its parent's while traversing rather than stored, and the
+/// elements of every subtree are stored contiguously (alongside their positions)
+typedef struct fqtree {
+  rect_t range;
+  size_t leaf_capacity;
+
+  size_t nodes_len;
+  fqtree_node_t *nodes;
+  // sums[n] belongs to nodes[n], NULL unless built with a value function
+  fqtree_sums_t *sums;
+  size_t items_len;
+  void **items;
+  v2f_t *points;
+} fqtree_t;
+
+/// Initialize an empty tree covering range, whose leaves are split once they
+/// hold more than leaf_capacity elements
+void fqtree_init(fqtree_t *fqtree, rect_t range, size_t leaf_capacity);
+
+/// Build the tree over len elements of stride bytes starting at elements by
+/// partitioning them in place quadrant by quadrant, storing the node and item
+/// arrays in an arena (elements outside the range are dropped); with a value
+/// function (may be NULL) every node also sums up its subtree
+void fqtree_build(
+  fqtree_t *fqtree,
+  arena_t *arena,
+  void *elements,
+  size_t len,
+  size_t stride,
+  fqtree_point_fn_t point,
+  fqtree_value_fn_t value
+);
+
+/// Like fqtree_build, but sort-based: every element in range is given the Morton
+/// code of its position, the codes are radix sorted (in parts units of work on
+/// pool) and the tree is then split top-down, each node's children found by
+/// binary search over its run of codes, so elements are only ever moved once. The tree has the same shape
+/// as fqtree_build's, up to elements within float rounding of a quadrant
+/// boundary, but its leaves list their elements in Z-order
+void fqtree_build_morton(
+  fqtree_t *fqtree,
+  arena_t *arena,
+  tpool_t *pool,
+  size_t parts,
+  void *elements,
+  size_t len,
+  size_t stride,
+  fqtree_point_fn_t point,
+  fqtree_value_fn_t value
+);
+
+/// List the leaves holding any elements into an array allocated from arena,
+/// returning how many there are
+size_t fqtree_leaves(const fqtree_t *fqtree, arena_t *arena, fqtree_leaf_t **out);
+
+/// Write elements falling into query_range into found (room for capacity
+/// elements) without allocating, returning how many were found in total; a
+/// result larger than capacity means found overflowed and only holds the first
+/// capacity elements
+size_t fqtree_query_into(
+  const fqtree_t *fqtree,
+  rect_t query_range,
+  void **found,
+  size_t capacity
+);
+
+/// Like fqtree_query_into, except that subtrees lying entirely inside
+/// query_range and at least sqrt(min_sqr_dist) away from origin are folded
+/// into aggregate (O(1) per subtree) instead of being written out; requires a
+/// tree built with a value function
+size_t fqtree_query_aggregate(
+  const fqtree_t *fqtree,
+  rect_t query_range,
+  v2f_t origin,
+  float min_sqr_dist,
+  void **found,
+  size_t capacity,
+  fqtree_aggregate_t *aggregate
+);
+
+/// Barnes-Hut style variant of fqtree_query_aggregate: subtrees wholly inside
+/// query_range are aggregated, and so are subtrees that are far enough from
+/// origin (their size over the distance to their centre of mass being below
+/// theta) provided that centre of mass falls into query_range; everything else
+/// is written out element by element, as is every subtree that may hold origin
+/// (so an element at origin is never folded into the totals). Requires a tree
+/// built with a value function
+size_t fqtree_query_far(
+  const fqtree_t *fqtree,
+  rect_t query_range,
+  v2f_t origin,
+  float theta,
+  void **found,
+  size_t capacity,
+  fqtree_aggregate_t *aggregate
+);
+
+/// Write the (at most) k elements nearest to center into found, nearest first,
+/// and their squared distances into sqr_dists (both with room for k), returning
+/// how many were written; like qtree_query_nearest, children are visited
+/// nearest first and skipped once they can't beat the k-th nearest so far
+size_t fqtree_query_nearest(
+  const fqtree_t *fqtree,
+  v2f_t center,
+  size_t k,
+  void **found,
+  float *sqr_dists
+);
+
+#endif // FQTREE_H
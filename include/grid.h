@@ -0,0 +1,55 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <stddef.h>
+
+#include "mvla.h"
+
+#include "rect.h"
+#include "arena.h"
+
+/// The function we inject to find where an element sits in the grid
+typedef v2f_t (*grid_point_fn_t)(void *ele);
+
+/// A uniform grid binning elements into equally sized cells; elements of the
+/// same cell are stored contiguously (alongside their positions)
+typedef struct grid {
+  rect_t range;
+  float cell_width;
+  float cell_height;
+  size_t cols;
+  size_t rows;
+
+  // cell c holds items[cell_start[c]..cell_start[c + 1]]
+  size_t *cell_start;
+  size_t items_len;
+  void **items;
+  v2f_t *points;
+} grid_t;
+
+/// Initialize an empty grid covering range, with cells of the given size
+void grid_init(grid_t *grid, rect_t range, float cell_width, float cell_height);
+
+/// Bin len elements of stride bytes starting at elements into the grid with a
+/// counting sort, storing the cell arrays in an arena (elements outside the
+/// range are clamped into the nearest border cell)
+void grid_build(
+  grid_t *grid,
+  arena_t *arena,
+  void *elements,
+  size_t len,
+  size_t stride,
+  grid_point_fn_t point
+);
+
+/// Get a list of all out_count elements in the grid falling into query_range
+/// (dont forget to free the memory returned)
+void **grid_query(grid_t *grid, rect_t query_range, size_t *out_count);
+
+/// Write elements falling into query_range into found (room for capacity
+/// elements) without allocating, returning how many were found in total; a
+/// result larger than capacity means found overflowed and only holds the first
+/// capacity elements
+size_t grid_query_into(grid_t *grid, rect_t query_range, void **found, size_t capacity);
+
+#endif // GRID_H
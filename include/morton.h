@@ -0,0 +1,34 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mvla.h"
+
+#include "rect.h"
+#include "arena.h"
+#include "tpool.h"
+
+#define MORTON_BITS (16) // bits per axis, codes cover a 2^16 x 2^16 grid
+
+/// Interleave the low MORTON_BITS bits of x and y into a Z-order curve index
+/// (x in the even bits, y in the odd bits)
+uint32_t morton_encode(uint32_t x, uint32_t y);
+
+/// Z-order curve index of point p, quantized over range (clamped to it)
+uint32_t morton_code(rect_t range, v2f_t p);
+
+/// Stable radix sort of len codes ascending, applying the same permutation to
+/// order; every pass is spread over parts units of work on pool, with scratch
+/// memory taken from arena
+void morton_sort(
+  tpool_t *pool,
+  size_t parts,
+  arena_t *arena,
+  uint32_t *codes,
+  uint32_t *order,
+  size_t len
+);
+
+#endif // MORTON_H
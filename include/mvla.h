@@ -43,6 +43,17 @@ extern "C" {
 ** ACCESS MODIFIER DEFINES
 */
 
+// MVLA_STATIC makes every function static inline and pulls the
+// implementation into each translation unit, so calls can be inlined
+#ifdef MVLA_STATIC
+#ifndef MVLADEF
+#define MVLADEF static inline
+#endif // MVLADEF
+#ifndef MVLAIMPL
+#define MVLAIMPL static inline
+#endif // MVLAIMPL
+#endif // MVLA_STATIC
+
 #ifndef MVLADEF
 #define MVLADEF extern
 #endif // MVLADEF
@@ -1508,7 +1519,19 @@ MVLADEF void v4d_print(v4d_t a);
 ** HEADER ONLY IMPLEMENTATION
 */
 
-#ifdef MVLA_IMPLEMENTATION
+// static mode emits the implementation once per translation unit, regardless
+// of MVLA_IMPLEMENTATION
+#if defined(MVLA_STATIC)
+#ifndef MVLA_STATIC_IMPLEMENTED
+#define MVLA_STATIC_IMPLEMENTED
+#define MVLA_EMIT_IMPLEMENTATION
+#endif // MVLA_STATIC_IMPLEMENTED
+#elif defined(MVLA_IMPLEMENTATION)
+#define MVLA_EMIT_IMPLEMENTATION
+#endif // MVLA_STATIC
+
+#ifdef MVLA_EMIT_IMPLEMENTATION
+#undef MVLA_EMIT_IMPLEMENTATION
 
 // -----------------------------------------
 
@@ -2591,7 +2614,7 @@ MVLAIMPL void v4d_print(v4d_t a) {
 
 // -----------------------------------------
 
-#endif // MVLA_IMPLEMENTATION
+#endif // MVLA_EMIT_IMPLEMENTATION
 
 #ifdef __cplusplus
 }
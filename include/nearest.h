@@ -0,0 +1,31 @@
+#ifndef NEAREST_H
+#define NEAREST_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/// The k nearest elements offered so far, kept as a max-heap on squared
+/// distance in caller provided arrays (room for k each) so the farthest of
+/// them, which bounds what is still worth looking at, is always at the top
+typedef struct nearest {
+  size_t k;
+  size_t len;
+  void **eles;
+  float *sqr_dists;
+} nearest_t;
+
+/// Start an empty set of the k nearest, stored in eles and sqr_dists
+void nearest_init(nearest_t *nearest, size_t k, void **eles, float *sqr_dists);
+
+/// Squared distance an element must beat to get in, INFINITY until k are held
+float nearest_bound(const nearest_t *nearest);
+
+/// Offer ele at sqr_dist, replacing the farthest held when full and nearer;
+/// returns whether it was taken
+bool nearest_offer(nearest_t *nearest, void *ele, float sqr_dist);
+
+/// Sort the held elements nearest first (the set is no longer a heap after),
+/// returning how many there are
+size_t nearest_sort(nearest_t *nearest);
+
+#endif // NEAREST_H
@@ -3,28 +3,67 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 #include "rect.h"
 #include "arena.h"
 
+#define QTREE_MAX_DEPTH (16) // full nodes this deep grow instead of subdividing
+
 /// The function we inject to treat qtree dynamically
 typedef bool (*qtree_range_fn_t)(void *ele, rect_t range);
 
+/// The function we inject to find where an element sits (for radius queries)
+typedef v2f_t (*qtree_point_fn_t)(void *ele);
+
+/// Counters bumped while elements are inserted into a tree (by qtree_insert,
+/// and qtree_split and qtree_update which insert through the same paths);
+/// atomic because subtrees may be filled by different threads at once
+typedef struct qtree_insert_stats {
+  atomic_size_t overflows; // inserts into a full node at QTREE_MAX_DEPTH
+  atomic_size_t grows;     // times such a node's data had to double
+  atomic_size_t max_depth; // deepest node an element was stored in
+} qtree_insert_stats_t;
+
 /// A quadtree representing subdivided 2D space, storing some data per tree node
 typedef struct qtree {
   qtree_range_fn_t check_range;
   rect_t range;
+  size_t depth;
 
+  // capacity elements fill a node before it subdivides, except at
+  // QTREE_MAX_DEPTH where data just keeps growing (data_capacity is its size)
   size_t capacity;
   size_t data_len;
+  size_t data_capacity;
   void **data;
 
+  // shared by every node of the tree, NULL unless counting (qtree_count_inserts)
+  qtree_insert_stats_t *stats;
+
   struct qtree *ne;
   struct qtree *se;
   struct qtree *sw;
   struct qtree *nw;
 } qtree_t;
 
+/// Elements that left their node during a qtree_update, waiting for an ancestor
+/// to take them back; zero initialize it, and keep it between updates so its
+/// room is only grown once
+typedef struct qtree_pending {
+  void **eles;
+  size_t len;
+  size_t capacity;
+} qtree_pending_t;
+
+/// What a qtree_update changed in a tree
+typedef struct qtree_update_stats {
+  size_t len;     // elements the tree still holds
+  size_t moved;   // elements that had left their node and were reinserted
+  size_t dropped; // elements that had left the whole tree, and were removed
+  size_t merged;  // nodes discarded by collapsing sparse subtrees
+} qtree_update_stats_t;
+
 /// Create a new qtree with the given capacity, range, and comparison function,
 /// storing the memory for this node in an arena
 qtree_t *qtree_new(
@@ -34,11 +73,80 @@ qtree_t *qtree_new(
   qtree_range_fn_t check_range
 );
 
-/// Insert an element into this tree, subdividing if full, returning success
+/// Insert an element into this tree, subdividing if full (or growing, at
+/// QTREE_MAX_DEPTH), returning success
 bool qtree_insert(qtree_t *qtree, arena_t *arena, void *ele);
 
+/// Fill this (empty) node from the front of eles exactly as repeated
+/// qtree_insert would, then subdivide and hand the leftovers to the children:
+/// out receives them grouped by child (ne, se, sw, nw), in their original
+/// order, with child_lens holding each group's length; inserting each group
+/// into its child yields the same tree as inserting everything into this node.
+/// Elements outside the node are dropped. Returns whether children were made
+bool qtree_split(
+  qtree_t *qtree,
+  arena_t *arena,
+  void **eles,
+  size_t len,
+  void **out,
+  size_t child_lens[4]
+);
+
+/// Bring a tree up to date after its elements have moved: every element no
+/// longer in the range of the node holding it is handed back up to the closest
+/// ancestor that still contains it and inserted from there (splitting full
+/// nodes as qtree_insert does), and on the way back up any subdivided node
+/// whose subtree holds no more than merge_len elements is collapsed into a
+/// single node. Keep merge_len below the capacity so nodes don't flip between
+/// splitting and merging every update. Elements in flight are held in pending,
+/// which is reset first and only grown when an update needs more room
+qtree_update_stats_t qtree_update(
+  qtree_t *qtree,
+  arena_t *arena,
+  size_t merge_len,
+  qtree_pending_t *pending
+);
+
+/// Free the room held by pending
+void qtree_pending_free(qtree_pending_t *pending);
+
+/// Zero stats and have qtree (a root no element was inserted into yet), and
+/// every node it subdivides into, count insertions into them
+void qtree_count_inserts(qtree_t *qtree, qtree_insert_stats_t *stats);
+
 /// Get a list of all out_count elements in the tree falling into query_range
 /// (dont forget to free the memory returned)
 void **qtree_query(qtree_t *qtree, rect_t query_range, size_t *out_count);
 
+/// Write elements falling into query_range into found (room for capacity
+/// elements) without allocating, returning how many were found in total; a
+/// result larger than capacity means found overflowed and only holds the first
+/// capacity elements
+size_t qtree_query_into(qtree_t *qtree, rect_t query_range, void **found, size_t capacity);
+
+/// Write elements within radius of center into found like qtree_query_into,
+/// skipping nodes whose range lies entirely outside the circle and only
+/// measuring elements (whose position point gives) in nodes straddling it
+size_t qtree_query_radius_into(
+  qtree_t *qtree,
+  v2f_t center,
+  float radius,
+  qtree_point_fn_t point,
+  void **found,
+  size_t capacity
+);
+
+/// Write the (at most) k elements nearest to center into found, nearest first,
+/// and their squared distances into sqr_dists (both with room for k), returning
+/// how many were written; nodes are visited nearest first and skipped once
+/// they lie farther away than the k-th nearest element found so far
+size_t qtree_query_nearest(
+  qtree_t *qtree,
+  v2f_t center,
+  size_t k,
+  qtree_point_fn_t point,
+  void **found,
+  float *sqr_dists
+);
+
 #endif // QTREE_H
\ No newline at end of file
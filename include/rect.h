@@ -24,6 +24,12 @@ bool rect_intersects(rect_t rect, rect_t other);
 /// Is rect full contained within other?
 bool rect_is_inside(rect_t rect, rect_t other);
 
+/// Squared distance from point to the nearest point of rect (0 if inside it)
+float rect_min_sqr_dist(rect_t rect, v2f_t point);
+
+/// Squared distance from point to the farthest corner of rect
+float rect_max_sqr_dist(rect_t rect, v2f_t point);
+
 /// Fill in ne/nw/sw/se with respective cartesian quadrants given this center 
 /// and half dimensions
 void rect_quadrants(rect_t rect, rect_t *ne, rect_t *nw, rect_t *sw, rect_t *se);
@@ -1,34 +1,288 @@
 #ifndef SIMULATION_H
 #define SIMULATION_H
 
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "tpool.h"
 
 #include "boid.h"
+#include "grid.h"
+#include "qtree.h"
 #include "arena.h"
 
 #define HOOD_RADIUS (60.0)
+#define KNN_MAX (64) // most nearest neighbours config.knn may ask for
 #define MAX_SPEED (200.0)
 #define MAX_FORCE (50.0)
 
+/// How the generation being read is laid out while the rules are evaluated
+typedef enum simulation_layout {
+  // neighbours are read straight out of the boid_t buffer, one at a time
+  SIMULATION_LAYOUT_AOS,
+  // neighbours are read from aligned columns the update keeps alongside the
+  // boid_t buffers, and summed several lanes at a time
+  SIMULATION_LAYOUT_SOA,
+} simulation_layout_t;
+
+/// Which spatial index answers neighbourhood queries during a tick
+typedef enum simulation_index {
+  // recursive quadtree, adapts to any distribution
+  SIMULATION_INDEX_QTREE,
+  // uniform grid with neighbourhood sized cells, flat O(n) build
+  SIMULATION_INDEX_GRID,
+  // quadtree linearised into one contiguous array of small nodes
+  SIMULATION_INDEX_FLAT,
+  // the recursive quadtree specialised for boids, positions stored inline
+  SIMULATION_INDEX_TYPED,
+} simulation_index_t;
+
+/// How boid updates are divided into units of work for the threadpool
+typedef enum simulation_schedule {
+  // one equally sized contiguous chunk per thread
+  SIMULATION_SCHEDULE_STATIC,
+  // threads repeatedly claim small chunks from a shared atomic cursor
+  SIMULATION_SCHEDULE_DYNAMIC,
+  // many chunks of equal cost, estimated from last tick's neighbour counts
+  SIMULATION_SCHEDULE_WEIGHTED,
+} simulation_schedule_t;
+
+/// Everything tunable about a simulation; sizes are fixed by simulation_init,
+/// while the modes and rule scales may be changed between ticks
+typedef struct simulation_config {
+  // dimensions for simulation, and how many boids live in it
+  float width, height;
+  size_t boids_len;
+
+  // threads in the pool, 0 for one per online CPU
+  size_t thread_count;
+  tpool_mode_t pool_mode;
+
+  // elements a quadtree node (or flat quadtree leaf) holds before subdividing
+  size_t qtree_capacity;
+
+  // scales applied to each rule's steering force (for customizing behaviour)
+  float separation_scale;
+  float alignment_scale;
+  float cohesion_scale;
+
+  simulation_layout_t layout;
+  simulation_index_t index;
+  simulation_schedule_t schedule;
+
+  // sort boids along a Z-order curve every reorder_interval ticks (0 = never),
+  // so boids close in space are close in memory
+  size_t reorder_interval;
+
+  // keep the quadtree between ticks, only relocating boids that left their
+  // node, instead of rebuilding it every tick
+  bool incremental;
+
+  // with SIMULATION_INDEX_FLAT, take alignment and cohesion from per-node
+  // totals for subtrees wholly inside a neighbourhood but outside separation range
+  bool aggregate;
+
+  // with SIMULATION_INDEX_FLAT and a far_radius above 0, alignment and
+  // cohesion perceive everything in the square of half-width far_radius
+  // around the boid (so up to far_radius*sqrt(2) away in its corners) instead
+  // of the neighbourhood, treating subtrees narrower than far_theta times
+  // their distance as a single boid at their centre of mass (Barnes-Hut)
+  float far_radius;
+  float far_theta;
+
+  // perceive neighbours within this radius (e.g. HOOD_RADIUS) instead of the
+  // NEIGHBOURHOOD_WIDTH x NEIGHBOURHOOD_HEIGHT box, 0 to keep the box
+  float hood_radius;
+
+  // with SIMULATION_INDEX_TYPED, accumulate the rules while walking the
+  // quadtree instead of listing the neighbours first
+  bool stream;
+
+  // with SIMULATION_INDEX_FLAT, build the tree from radix sorted Morton codes
+  // instead of partitioning the boids quadrant by quadrant
+  bool bulk;
+
+  // with SIMULATION_INDEX_FLAT (and neither aggregate nor far_radius), query
+  // once per leaf for the candidates of all its boids, then filter that shared
+  // list for each boid instead of walking the tree once per boid
+  bool batch;
+
+  // with SIMULATION_INDEX_GRID (and the box neighbourhood), visit every pair
+  // of neighbours once from adjacent grid cells and add its contribution to
+  // both boids, rather than have each boid query and sum on its own
+  bool pairs;
+
+  // above 0, cache every boid's neighbours within its neighbourhood grown by
+  // skin on each side, and reuse those lists (skipping the spatial index) until
+  // some boid has moved more than skin/2; ignored with aggregate, far_radius,
+  // batch, pairs or knn
+  float skin;
+
+  // record every tick's neighbour graph in sim->graph, which the rules then
+  // read their neighbours from; ignored with aggregate, far_radius, batch,
+  // pairs or skin
+  bool graph;
+
+  // above 0, interact with the knn nearest boids (e.g. 7, like starlings do)
+  // instead of everyone within the neighbourhood (or radius), so no boid ever
+  // sums more than knn neighbours however dense the flock; at most KNN_MAX,
+  // and aggregate, batch, pairs and skin are ignored while it is on
+  size_t knn;
+
+  // above 0, neighbourhoods holding more than sample boids are summed over a
+  // subsample of about that many, scaled back up to the whole neighbourhood;
+  // bounds the rule math per boid in dense clumps. Whether a neighbour is in
+  // the subsample hashes its stable id with the boid's and the tick, so runs
+  // repeat whichever index, schedule or ordering lists the neighbours, and
+  // boids sharing a point still draw their own. Ignored by stream and pairs,
+  // which never list neighbours
+  size_t sample;
+} simulation_config_t;
+
+/// Memory owned by one pool thread: room for the neighbours of one boid (grown
+/// on overflow) and an arena for the parts of the spatial index it builds, both
+/// reused across ticks so a steady state tick never allocates
+typedef struct simulation_scratch {
+  size_t capacity;
+  boid_t **neighbours;
+  arena_t arena;
+  // like arena, but only cleared when the persistent quadtree is rebuilt
+  arena_t tree_arena;
+  // the candidates shared by a leaf's boids, with their positions in columns
+  // (only used by config.batch, grown like neighbours)
+  size_t candidates_capacity;
+  boid_t **candidates;
+  float *candidates_x;
+  float *candidates_y;
+} simulation_scratch_t;
+
+/// One thread's share of a set of neighbour lists, grown as needed
+typedef struct simulation_list_part {
+  size_t capacity;
+  size_t len;
+  uint32_t *indices;
+} simulation_list_part_t;
+
+/// Neighbour lists cached for config.skin (Verlet lists): boid i's list holds
+/// the indices into boids of everything that was within its grown
+/// neighbourhood, which stays a superset of its true neighbours for as long as
+/// no boid has moved more than half the skin since. The few boids that do
+/// (mostly by wrapping around the edges) become movers, which are left out of
+/// the lists and found through grids instead, until there are too many of them
+typedef struct simulation_verlet {
+  bool valid;
+  // what the lists were built for, a change invalidates them
+  float skin;
+  float radius;
+  // where each boid was when the lists were built, and a grid over those
+  // positions (allocated from arena) to find the neighbours of movers in
+  v2f_t *origins;
+  grid_t origins_grid;
+  arena_t arena;
+  // lists[i] points at lens[i] indices in one of the parts
+  uint32_t **lists;
+  uint32_t *lens;
+  size_t parts_len;
+  simulation_list_part_t *parts;
+  // moved[i] is set for movers, the movers_len of which are listed in movers;
+  // movers_grid bins them by their current position (rebuilt every tick)
+  bool *moved;
+  size_t movers_len;
+  uint32_t *movers;
+  grid_t movers_grid;
+} simulation_verlet_t;
+
+/// The neighbour graph of the last tick in compressed sparse row form: boid i
+/// saw the boids indices[offsets[i]..offsets[i + 1]] (indexing boids, so
+/// including itself) as its neighbours; len is 0 when none was recorded
+typedef struct simulation_graph {
+  size_t len;
+  uint32_t *offsets; // len + 1 of them
+  size_t edges_len;
+  uint32_t *indices;
+} simulation_graph_t;
+
 /// A boids flocking simulation (rules for separation, alignment, cohesion)
 typedef struct simulation {
   size_t ticks;
   arena_t arena;
+  simulation_config_t config;
 
-  // threadpool for boid updates
+  // threadpool for boid updates, with query scratch for each of its threads
+  size_t thread_count;
   tpool_t *pool;
+  size_t scratch_len;
+  simulation_scratch_t *scratch;
 
   // dimensions for simulation
   float width, height;
 
-  // fixed size list of boids
+  // fixed size list of boids, ids[i] being the stable identity of boids[i]
+  // (boids may be reordered in memory, see config.reorder_interval)
   size_t  boids_len;
   boid_t *boids;
   boid_t *boids_swap;
+  uint32_t *ids;
+
+  // column-wise copies of boids and boids_swap, only allocated and written for
+  // SIMULATION_LAYOUT_SOA; the update writes the next generation into soa_swap
+  // alongside boids_swap, and the two are swapped together
+  boid_soa_t soa;
+  boid_soa_t soa_swap;
+
+  // the neighbour count each boid saw last tick (a proxy for its cost)
+  uint32_t *costs;
+
+  // what inserting into the quadtree (SIMULATION_INDEX_QTREE) ran into since
+  // it was last built: every tick, or every rebuild with config.incremental
+  qtree_insert_stats_t qtree_stats;
+
+  // persistent quadtree for config.incremental, indexing tracked (a copy of
+  // boids refreshed every tick, so the tree's pointers survive buffer swaps);
+  // NULL until built, and reset whenever a rebuild is due
+  qtree_t *qtree;
+  boid_t *tracked;
+  arena_t tree_arena;
+  // nodes discarded by merges since the last rebuild
+  size_t tree_garbage;
+  // boids in flight while the tree is updated, kept so its room is reused
+  qtree_pending_t tree_pending;
+
+  // cached neighbour lists for config.skin
+  simulation_verlet_t verlet;
+
+  // neighbour graph for config.graph, allocated from graph_arena (kept until
+  // the next graph is recorded) and gathered from one part per thread
+  simulation_graph_t graph;
+  arena_t graph_arena;
+  size_t graph_parts_len;
+  simulation_list_part_t *graph_parts;
 } simulation_t;
 
-/// Initialize a simulation with boids_len randomly spawned boids
-void simulation_init(simulation_t *sim, float width, float height, size_t boids_len);
+/// The configuration the simulation was originally tuned with
+simulation_config_t simulation_config_default(void);
+
+/// Apply a single named setting (as listed by simulation_config_usage) to
+/// config, returning false if the name is unknown or the value malformed
+bool simulation_config_set(simulation_config_t *config, const char *name, const char *value);
+
+/// Apply a command line argument of the form --name=value to config, returning
+/// false if it is not of that form or simulation_config_set rejects it
+bool simulation_config_set_arg(simulation_config_t *config, const char *arg);
+
+/// Print every setting simulation_config_set understands, one per line
+void simulation_config_usage(FILE *out);
+
+/// Parse a whole non-negative integer setting (no trailing characters),
+/// returning success
+bool simulation_parse_size(const char *value, size_t *out);
+
+/// Parse a whole float setting (no trailing characters), returning success
+bool simulation_parse_float(const char *value, float *out);
+
+/// Initialize a simulation with config.boids_len randomly spawned boids
+void simulation_init(simulation_t *sim, const simulation_config_t *config);
 
 /// Free a simulations memory
 void simulation_free(simulation_t *sim);
@@ -2,6 +2,9 @@
 #define TPOOL_H
 
 #include <stddef.h>
+#include <stdbool.h>
+
+#define TPOOL_NO_WORKER ((size_t) -1)
 
 /// A function type we will use to represent a unit of work to perform in parallel
 typedef void (*thread_func_t)(void *arg);
@@ -9,9 +12,21 @@ typedef void (*thread_func_t)(void *arg);
 /// A fixed-size threadpool, implemented using pthreads
 typedef struct tpool tpool_t;
 
+/// How a threadpool hands out work to its threads
+typedef enum tpool_mode {
+  // one shared queue behind one lock, every submission wakes every thread
+  TPOOL_MODE_SHARED,
+  // a deque per thread; threads run their own work newest first and idle
+  // threads steal the oldest work from busy ones
+  TPOOL_MODE_STEALING,
+} tpool_mode_t;
+
 /// Initalize a threadpool
 tpool_t *tpool_new(size_t num);
 
+/// Initalize a threadpool handing out work the given way
+tpool_t *tpool_new_mode(size_t num, tpool_mode_t mode);
+
 /// Free a threadpool and all its threads, waiting on outstanding work
 void tpool_free(tpool_t *tp);
 
@@ -21,4 +36,8 @@ bool tpool_add_work(tpool_t *tp, thread_func_t func, void *arg);
 /// Wait for all work in the queue to finish
 void tpool_wait(tpool_t *tp);
 
+/// Index (0..num) of the pool thread calling this, stable for the lifetime of
+/// the thread, or TPOOL_NO_WORKER when not called from within a threadpool
+size_t tpool_worker_index(void);
+
 #endif // TPOOL_H
@@ -0,0 +1,320 @@
+#ifndef TQTREE_H
+#define TQTREE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "mvla.h"
+
+#include "rect.h"
+#include "arena.h"
+
+#define TQTREE_MAX_DEPTH (16) // like QTREE_MAX_DEPTH, full nodes this deep grow instead
+
+/*
+** A quadtree specialised for one element type at compile time (a C template):
+**
+**   TQTREE_DECLARE(name, type)           declares name_t and name_entry_t
+**   TQTREE_DEFINE(name, type, point_of)  defines the static inline functions
+**
+** where point_of(const type *) gives an element's position. Each node stores
+** its elements' positions inline next to their pointers, so neither inserting
+** nor querying calls through a function pointer or dereferences an element, and
+** the containment test inlines into the loops. Nodes are split exactly like
+** qtree_t (internal nodes hold data, children tried in the same order), so
+** both trees hold and return the same elements in the same order.
+**
+** Generated functions, mirroring qtree.h:
+**
+**   name_t *name_new(arena_t *arena, size_t capacity, rect_t range);
+**   bool name_insert(name_t *tree, arena_t *arena, type *ele);
+**   bool name_split(name_t *tree, arena_t *arena, type **eles, size_t len,
+**                   type **out, size_t child_lens[4]);
+**   size_t name_query_into(name_t *tree, rect_t range, type **found,
+**                          size_t capacity);
+**
+** Queries can also stream their results instead of listing them:
+**
+**   TQTREE_VISITOR(name, func, state_type, visit)
+**
+** defines void func(name_t *tree, rect_t range, state_type *state), calling
+** visit(state, ele, point) on every element in range during the traversal
+** (in the same order name_query_into lists them). visit is called directly,
+** so it can be inlined into the loop.
+*/
+
+/// rect_contains_point, but visible to the compiler so it can be inlined
+static inline bool tqtree_contains(rect_t rect, v2f_t point) {
+  return (point.x >= rect.center.x - rect.half_width &&
+          point.x <= rect.center.x + rect.half_width &&
+          point.y >= rect.center.y - rect.half_height &&
+          point.y <= rect.center.y + rect.half_height);
+}
+
+#define TQTREE_DECLARE(name, type)                                              \
+  /* An element alongside the position it was inserted at */                    \
+  typedef struct name##_entry {                                                 \
+    v2f_t point;                                                                \
+    type *ele;                                                                  \
+  } name##_entry_t;                                                             \
+                                                                                \
+  /* A quadtree node, storing some entries per node */                          \
+  typedef struct name {                                                         \
+    rect_t range;                                                               \
+    size_t depth;                                                               \
+                                                                                \
+    size_t capacity;                                                            \
+    size_t data_len;                                                            \
+    size_t data_capacity;                                                       \
+    name##_entry_t *data;                                                       \
+                                                                                \
+    struct name *ne;                                                            \
+    struct name *se;                                                            \
+    struct name *sw;                                                            \
+    struct name *nw;                                                            \
+  } name##_t;
+
+#define TQTREE_DEFINE(name, type, point_of)                                     \
+  static inline name##_t *name##_new(                                           \
+    arena_t *arena,                                                             \
+    size_t capacity,                                                            \
+    rect_t range                                                                \
+  ) {                                                                           \
+    assert(arena != NULL);                                                      \
+    assert(capacity > 0);                                                       \
+                                                                                \
+    name##_t *tree = arena_alloc(arena, sizeof(name##_t));                      \
+    assert(tree != NULL);                                                       \
+                                                                                \
+    tree->range = range;                                                        \
+    tree->depth = 0;                                                            \
+                                                                                \
+    tree->capacity = capacity;                                                  \
+    tree->data_len = 0;                                                         \
+    tree->data_capacity = capacity;                                             \
+    tree->data = arena_alloc(arena, capacity*sizeof(name##_entry_t));           \
+    assert(tree->data != NULL);                                                 \
+                                                                                \
+    tree->ne = NULL;                                                            \
+    tree->se = NULL;                                                            \
+    tree->sw = NULL;                                                            \
+    tree->nw = NULL;                                                            \
+                                                                                \
+    return tree;                                                                \
+  }                                                                             \
+                                                                                \
+  static inline void name##_subdivide(name##_t *tree, arena_t *arena) {         \
+    assert(tree != NULL);                                                       \
+                                                                                \
+    /* same argument order as qtree_t's subdivide, so quadrants match */        \
+    rect_t ne = {0}, se = {0}, sw = {0}, nw = {0};                              \
+    rect_quadrants(tree->range, &ne, &se, &sw, &nw);                            \
+                                                                                \
+    tree->ne = name##_new(arena, tree->capacity, ne);                           \
+    tree->se = name##_new(arena, tree->capacity, se);                           \
+    tree->sw = name##_new(arena, tree->capacity, sw);                           \
+    tree->nw = name##_new(arena, tree->capacity, nw);                           \
+                                                                                \
+    tree->ne->depth = tree->depth + 1;                                          \
+    tree->se->depth = tree->depth + 1;                                          \
+    tree->sw->depth = tree->depth + 1;                                          \
+    tree->nw->depth = tree->depth + 1;                                          \
+  }                                                                             \
+                                                                                \
+  static inline void name##_grow_data(name##_t *tree, arena_t *arena) {         \
+    size_t data_capacity = 2*tree->data_capacity;                               \
+    size_t size = data_capacity*sizeof(name##_entry_t);                         \
+    name##_entry_t *data = arena_alloc(arena, size);                            \
+    assert(data != NULL);                                                       \
+    for (size_t i = 0; i < tree->data_len; ++i) {                               \
+      data[i] = tree->data[i];                                                  \
+    }                                                                           \
+    tree->data = data;                                                          \
+    tree->data_capacity = data_capacity;                                        \
+  }                                                                             \
+                                                                                \
+  static inline bool name##_insert_entry(                                       \
+    name##_t *tree,                                                             \
+    arena_t *arena,                                                             \
+    name##_entry_t entry                                                        \
+  ) {                                                                           \
+    assert(tree != NULL);                                                       \
+                                                                                \
+    if (!tqtree_contains(tree->range, entry.point)) {                           \
+      return false;                                                             \
+    }                                                                           \
+                                                                                \
+    if (tree->data_len < tree->capacity) {                                      \
+      tree->data[tree->data_len++] = entry;                                     \
+      return true;                                                              \
+    }                                                                           \
+                                                                                \
+    if (tree->depth >= TQTREE_MAX_DEPTH) {                                      \
+      if (tree->data_len == tree->data_capacity) {                              \
+        name##_grow_data(tree, arena);                                          \
+      }                                                                         \
+      tree->data[tree->data_len++] = entry;                                     \
+      return true;                                                              \
+    }                                                                           \
+                                                                                \
+    if (tree->ne == NULL) {                                                     \
+      name##_subdivide(tree, arena);                                            \
+    }                                                                           \
+                                                                                \
+    return (name##_insert_entry(tree->ne, arena, entry) ||                      \
+            name##_insert_entry(tree->se, arena, entry) ||                      \
+            name##_insert_entry(tree->sw, arena, entry) ||                      \
+            name##_insert_entry(tree->nw, arena, entry));                       \
+  }                                                                             \
+                                                                                \
+  static inline bool name##_insert(name##_t *tree, arena_t *arena, type *ele) { \
+    assert(ele != NULL);                                                        \
+    name##_entry_t entry = {point_of(ele), ele};                                \
+    return name##_insert_entry(tree, arena, entry);                             \
+  }                                                                             \
+                                                                                \
+  static inline bool name##_split(                                              \
+    name##_t *tree,                                                             \
+    arena_t *arena,                                                             \
+    type **eles,                                                                \
+    size_t len,                                                                 \
+    type **out,                                                                 \
+    size_t child_lens[4]                                                        \
+  ) {                                                                           \
+    assert(tree != NULL);                                                       \
+    assert(tree->data_len == 0 && tree->ne == NULL);                            \
+                                                                                \
+    for (size_t c = 0; c < 4; ++c) {                                            \
+      child_lens[c] = 0;                                                        \
+    }                                                                           \
+                                                                                \
+    /* the first elements in range stay with us, just like insert */            \
+    size_t i = 0;                                                               \
+    for (; i < len && tree->data_len < tree->capacity; ++i) {                   \
+      name##_entry_t entry = {point_of(eles[i]), eles[i]};                      \
+      if (tqtree_contains(tree->range, entry.point)) {                          \
+        tree->data[tree->data_len++] = entry;                                   \
+      }                                                                         \
+    }                                                                           \
+    if (i == len) {                                                             \
+      return false;                                                             \
+    }                                                                           \
+                                                                                \
+    if (tree->depth >= TQTREE_MAX_DEPTH) {                                      \
+      for (; i < len; ++i) {                                                    \
+        name##_insert(tree, arena, eles[i]);                                    \
+      }                                                                         \
+      return false;                                                             \
+    }                                                                           \
+                                                                                \
+    name##_subdivide(tree, arena);                                              \
+    name##_t *children[4] = {tree->ne, tree->se, tree->sw, tree->nw};           \
+                                                                                \
+    /* remember which child takes each leftover (4 meaning none) */             \
+    size_t rest = len - i;                                                      \
+    unsigned char *route = arena_alloc(arena, rest);                            \
+    assert(route != NULL);                                                      \
+    for (size_t j = 0; j < rest; ++j) {                                         \
+      v2f_t p = point_of(eles[i + j]);                                          \
+      route[j] = 4;                                                             \
+      if (!tqtree_contains(tree->range, p)) {                                   \
+        continue;                                                               \
+      }                                                                         \
+      for (unsigned char c = 0; c < 4; ++c) {                                   \
+        if (tqtree_contains(children[c]->range, p)) {                           \
+          route[j] = c;                                                         \
+          child_lens[c] += 1;                                                   \
+          break;                                                                \
+        }                                                                       \
+      }                                                                         \
+    }                                                                           \
+                                                                                \
+    /* stable scatter into per-child groups */                                  \
+    size_t offsets[4] = {0};                                                    \
+    for (size_t c = 1; c < 4; ++c) {                                            \
+      offsets[c] = offsets[c - 1] + child_lens[c - 1];                          \
+    }                                                                           \
+    for (size_t j = 0; j < rest; ++j) {                                         \
+      if (route[j] < 4) {                                                       \
+        out[offsets[route[j]]++] = eles[i + j];                                 \
+      }                                                                         \
+    }                                                                           \
+                                                                                \
+    return true;                                                                \
+  }                                                                             \
+                                                                                \
+  static inline void name##_query_recursive(                                    \
+    name##_t *tree,                                                             \
+    rect_t range,                                                               \
+    type **found,                                                               \
+    size_t *found_count,                                                        \
+    size_t found_capacity                                                       \
+  ) {                                                                           \
+    if (!rect_intersects(tree->range, range)) {                                 \
+      return;                                                                   \
+    }                                                                           \
+                                                                                \
+    bool add_all = rect_is_inside(tree->range, range);                          \
+    for (size_t i = 0; i < tree->data_len; ++i) {                               \
+      if (add_all || tqtree_contains(range, tree->data[i].point)) {             \
+        if (*found_count < found_capacity) {                                    \
+          found[*found_count] = tree->data[i].ele;                              \
+        }                                                                       \
+        *found_count += 1;                                                      \
+      }                                                                         \
+    }                                                                           \
+                                                                                \
+    if (tree->ne != NULL) {                                                     \
+      name##_query_recursive(                                                   \
+        tree->ne, range, found, found_count, found_capacity                     \
+      );                                                                        \
+      name##_query_recursive(                                                   \
+        tree->se, range, found, found_count, found_capacity                     \
+      );                                                                        \
+      name##_query_recursive(                                                   \
+        tree->sw, range, found, found_count, found_capacity                     \
+      );                                                                        \
+      name##_query_recursive(                                                   \
+        tree->nw, range, found, found_count, found_capacity                     \
+      );                                                                        \
+    }                                                                           \
+  }                                                                             \
+                                                                                \
+  static inline size_t name##_query_into(                                       \
+    name##_t *tree,                                                             \
+    rect_t range,                                                               \
+    type **found,                                                               \
+    size_t capacity                                                             \
+  ) {                                                                           \
+    assert(tree != NULL);                                                       \
+    assert(found != NULL || capacity == 0);                                     \
+                                                                                \
+    size_t found_count = 0;                                                     \
+    name##_query_recursive(tree, range, found, &found_count, capacity);         \
+    return found_count;                                                         \
+  }
+
+#define TQTREE_VISITOR(name, func, state_type, visit)                           \
+  static inline void func(name##_t *tree, rect_t range, state_type *state) {    \
+    assert(tree != NULL);                                                       \
+    if (!rect_intersects(tree->range, range)) {                                 \
+      return;                                                                   \
+    }                                                                           \
+                                                                                \
+    bool add_all = rect_is_inside(tree->range, range);                          \
+    for (size_t i = 0; i < tree->data_len; ++i) {                               \
+      if (add_all || tqtree_contains(range, tree->data[i].point)) {             \
+        visit(state, tree->data[i].ele, tree->data[i].point);                   \
+      }                                                                         \
+    }                                                                           \
+                                                                                \
+    if (tree->ne != NULL) {                                                     \
+      func(tree->ne, range, state);                                             \
+      func(tree->se, range, state);                                             \
+      func(tree->sw, range, state);                                             \
+      func(tree->nw, range, state);                                             \
+    }                                                                           \
+  }
+
+#endif // TQTREE_H
@@ -1,6 +1,7 @@
 #!/bin/bash
 
 BIN=boids
+BENCH_BIN=boids_bench
 BUILD=build
 CONFIG=Release
 CFLAGS="-O2"
@@ -12,6 +13,7 @@ function usage() {
   echo "  - profile             "
   echo "  - build               "
   echo "  - run                 "
+  echo "  - bench [FLAGS...]    "
   echo "  - doit                "
   echo "  - clean               "
 }
@@ -64,6 +66,28 @@ function run() {
   fi
 }
 
+function bench() {
+  cd $WORKDIR
+
+  echo "Benchmarking with $CONFIG..."
+  echo ""
+
+  if [[ "$OSTYPE" == "msys" || "$OSTYPE" == "cygwin" || "$OSTYPE" == "win32" ]]; then
+    # windows environment
+    EXECUTABLE="$BUILD/$CONFIG/$BENCH_BIN.exe"
+  else
+    # unix-based environment
+    EXECUTABLE="$BUILD/$BENCH_BIN"
+  fi
+
+  if [[ -f "$EXECUTABLE" ]]; then
+    ./"$EXECUTABLE" "$@"
+  else
+    echo "Error - executable $EXECUTABLE not found"
+    exit 1
+  fi
+}
+
 function clean() {
   cd $WORKDIR
   
@@ -85,6 +109,10 @@ case $1 in
   run)
     run
     ;;
+  bench)
+    shift
+    bench "$@"
+    ;;
   doit)
     build && run
     ;;
@@ -47,10 +47,9 @@ void *arena_alloc(arena_t *arena, size_t size_bytes) {
     arena->end = arena->end->next;
   }
 
-  assert(arena->end->next == NULL);
-
   if (arena->end->offset + size > arena->end->capacity) {
-    // add new region at end
+    // we only run out of room on the last region, add new region at end
+    assert(arena->end->next == NULL);
     size_t capacity = REGION_DEFAULT_CAPACITY;
     if (capacity < size) capacity = size;
     arena->end->next = new_region(capacity);
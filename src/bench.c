@@ -0,0 +1,172 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#define MVLA_IMPLEMENTATION
+#include "mvla.h"
+#undef  MVLA_IMPLEMENTATION
+
+#include "simulation.h"
+
+#define TICK_COUNT (500)
+#define WARMUP_COUNT (20)
+#define DELTA_TIME (1.0/60.0)
+
+/// Options controlling a benchmark run (besides the simulation config)
+typedef struct bench_options {
+  size_t ticks;
+  size_t warmup;
+  float dt;
+  unsigned int seed;
+} bench_options_t;
+
+/// Print how to invoke the benchmark
+static void usage(const char *name);
+/// Value of arg if it is --name=value for the given name, otherwise NULL
+static const char *arg_value(const char *arg, const char *name);
+/// Parse command line flags into options and config, returning false on bad input
+static bool parse_options(int argc, char *argv[], bench_options_t *opts, simulation_config_t *config);
+/// Monotonic wall clock in nanoseconds
+static double now_ns(void);
+/// qsort comparator for tick latencies
+static int compare_doubles(const void *a, const void *b);
+/// Nearest-rank percentile p (0..100) of sorted samples
+static double percentile(const double *sorted, size_t len, double p);
+
+int main(int argc, char *argv[]) {
+  bench_options_t opts = {
+    .ticks = TICK_COUNT,
+    .warmup = WARMUP_COUNT,
+    .dt = DELTA_TIME,
+    .seed = 1,
+  };
+  simulation_config_t config = simulation_config_default();
+  if (!parse_options(argc, argv, &opts, &config)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // fixed seed so runs spawn identical populations
+  srand(opts.seed);
+
+  simulation_t sim = {0};
+  simulation_init(&sim, &config);
+
+  for (size_t i = 0; i < opts.warmup; ++i) {
+    simulation_tick(&sim, opts.dt);
+  }
+
+  double *samples = calloc(opts.ticks, sizeof(double));
+  assert(samples != NULL);
+
+  double total_beg = now_ns();
+  for (size_t i = 0; i < opts.ticks; ++i) {
+    double beg = now_ns();
+    simulation_tick(&sim, opts.dt);
+    samples[i] = now_ns() - beg;
+  }
+  double total = now_ns() - total_beg;
+
+  qsort(samples, opts.ticks, sizeof(double), compare_doubles);
+
+  double mean = total/(double) opts.ticks;
+  printf("boids:       %zu\n", sim.boids_len);
+  printf("threads:     %zu\n", sim.thread_count);
+  printf("ticks:       %zu (+%zu warmup)\n", opts.ticks, opts.warmup);
+  printf("ticks/sec:   %.2f\n", 1e9/mean);
+  printf("ns/boid:     %.2f\n", mean/(double) sim.boids_len);
+  printf("tick p50:    %.3f ms\n", percentile(samples, opts.ticks, 50.0)/1e6);
+  printf("tick p90:    %.3f ms\n", percentile(samples, opts.ticks, 90.0)/1e6);
+  printf("tick p99:    %.3f ms\n", percentile(samples, opts.ticks, 99.0)/1e6);
+  printf("tick max:    %.3f ms\n", samples[opts.ticks - 1]/1e6);
+  if (config.index == SIMULATION_INDEX_QTREE) {
+    // gathered while the last tick (or the last rebuild) filled the quadtree
+    printf("qtree depth: %zu (%zu overflow inserts, %zu grown buckets)\n",
+      atomic_load(&sim.qtree_stats.max_depth),
+      atomic_load(&sim.qtree_stats.overflows),
+      atomic_load(&sim.qtree_stats.grows)
+    );
+  }
+  if (sim.graph.len > 0) {
+    // the last tick's neighbour graph is still around for analytics
+    printf("neighbours:  %.2f per boid\n", (double) sim.graph.edges_len/(double) sim.graph.len);
+  }
+
+  free(samples);
+  simulation_free(&sim);
+
+  // run until all threads finish (avoid pthread_create memory leaks in valgrind)
+  pthread_exit(NULL);
+
+  return EXIT_SUCCESS;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+    "Usage: %s [--name=value...]\n"
+    "  --ticks=<n>          measured ticks (default %d)\n"
+    "  --warmup=<n>         unmeasured warmup ticks (default %d)\n"
+    "  --dt=<seconds>       seconds advanced per tick (default 1/60)\n"
+    "  --seed=<n>           random seed for spawning (default 1)\n",
+    name, TICK_COUNT, WARMUP_COUNT
+  );
+  simulation_config_usage(stderr);
+}
+
+static const char *arg_value(const char *arg, const char *name) {
+  size_t name_len = strlen(name);
+  if (strncmp(arg, "--", 2) != 0) return NULL;
+  if (strncmp(arg + 2, name, name_len) != 0 || arg[2 + name_len] != '=') return NULL;
+  return arg + 2 + name_len + 1;
+}
+
+static bool parse_options(int argc, char *argv[], bench_options_t *opts, simulation_config_t *config) {
+  assert(opts != NULL);
+  assert(config != NULL);
+  for (int i = 1; i < argc; ++i) {
+    const char *value = NULL;
+    size_t seed = 0;
+    if ((value = arg_value(argv[i], "ticks")) != NULL) {
+      if (!simulation_parse_size(value, &opts->ticks)) return false;
+    } else if ((value = arg_value(argv[i], "warmup")) != NULL) {
+      if (!simulation_parse_size(value, &opts->warmup)) return false;
+    } else if ((value = arg_value(argv[i], "dt")) != NULL) {
+      if (!simulation_parse_float(value, &opts->dt)) return false;
+    } else if ((value = arg_value(argv[i], "seed")) != NULL) {
+      if (!simulation_parse_size(value, &seed) || seed > UINT_MAX) return false;
+      opts->seed = (unsigned int) seed;
+    } else if (!simulation_config_set_arg(config, argv[i])) {
+      return false;
+    }
+  }
+  return config->boids_len > 0 && opts->ticks > 0 &&
+         config->width > 0.0 && config->height > 0.0;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec*1e9 + (double) ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t len, double p) {
+  assert(len > 0);
+  // the smallest sample with at least p percent of samples at or below it
+  size_t rank = (size_t) ceil(p/100.0*(double) len);
+  if (rank == 0) rank = 1;
+  if (rank > len) rank = len;
+  return sorted[rank - 1];
+}
+
@@ -1,9 +1,14 @@
+#include <stdlib.h>
+#include <assert.h>
+
 #include "mvla.h"
 
 #include "boid.h"
 
 /// Get the neighbourhood given side lengths through a boid's center
 static rect_t neighbourhood_from_distances(boid_t boid, float width, float height);
+/// Allocate a single zeroed, BOID_SOA_ALIGN aligned column of capacity floats
+static float *new_column(size_t capacity);
 
 boid_t boid_new(v2f_t position, v2f_t velocity) {
   boid_t boid;
@@ -20,7 +25,64 @@ rect_t boid_neighbourhood(boid_t boid) {
   return neighbourhood_from_distances(boid, NEIGHBOURHOOD_WIDTH, NEIGHBOURHOOD_HEIGHT);
 }
 
+void boid_soa_init(boid_soa_t *soa, size_t len) {
+  assert(soa != NULL);
+  // aligned_alloc wants a size that is a multiple of the alignment
+  size_t per_align = BOID_SOA_ALIGN/sizeof(float);
+  soa->len = len;
+  soa->capacity = ((len + per_align - 1)/per_align)*per_align;
+  if (soa->capacity == 0) soa->capacity = per_align;
+  soa->px = new_column(soa->capacity);
+  soa->py = new_column(soa->capacity);
+  soa->vx = new_column(soa->capacity);
+  soa->vy = new_column(soa->capacity);
+}
+
+void boid_soa_free(boid_soa_t *soa) {
+  assert(soa != NULL);
+  free(soa->px);
+  free(soa->py);
+  free(soa->vx);
+  free(soa->vy);
+  soa->px = NULL;
+  soa->py = NULL;
+  soa->vx = NULL;
+  soa->vy = NULL;
+  soa->len = 0;
+  soa->capacity = 0;
+}
+
+void boid_soa_load(boid_soa_t *soa, const boid_t *boids, size_t len) {
+  assert(soa != NULL);
+  assert(len <= soa->capacity);
+  for (size_t i = 0; i < len; ++i) {
+    soa->px[i] = boids[i].position.x;
+    soa->py[i] = boids[i].position.y;
+    soa->vx[i] = boids[i].velocity.x;
+    soa->vy[i] = boids[i].velocity.y;
+  }
+  soa->len = len;
+}
+
+void boid_soa_store(boid_soa_t *soa, size_t i, boid_t boid) {
+  assert(soa != NULL);
+  assert(i < soa->len);
+  soa->px[i] = boid.position.x;
+  soa->py[i] = boid.position.y;
+  soa->vx[i] = boid.velocity.x;
+  soa->vy[i] = boid.velocity.y;
+}
+
 static rect_t neighbourhood_from_distances(boid_t boid, float width, float height) {
   float hw = width/2.0, hh = height/2.0;
   return rect_new(boid.position, hw, hh);
+}
+
+static float *new_column(size_t capacity) {
+  float *column = aligned_alloc(BOID_SOA_ALIGN, capacity*sizeof(float));
+  assert(column != NULL);
+  for (size_t i = 0; i < capacity; ++i) {
+    column[i] = 0.0;
+  }
+  return column;
 }
\ No newline at end of file
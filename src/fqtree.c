@@ -0,0 +1,714 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "rect.h"
+#include "fqtree.h"
+#include "morton.h"
+#include "nearest.h"
+
+/// Upper bound on the nodes a tree over len elements can need
+static size_t max_nodes(size_t len, size_t leaf_capacity);
+/// Split node into four children if it holds too many elements, recursively
+static void build_recursive(fqtree_t *fqtree, uint32_t node, rect_t bounds, size_t depth);
+/// Split node into four children by the next quadrant digit of the sorted
+/// codes of its items, recursively
+static void build_sorted(fqtree_t *fqtree, const uint32_t *codes, uint32_t node, size_t depth);
+/// First index in codes[beg..end] whose quadrant digit at shift is at least digit
+static size_t lower_digit(const uint32_t *codes, size_t beg, size_t end, size_t shift, uint32_t digit);
+/// Give node four children holding items[splits[c]..splits[c + 1]], returning
+/// the index of the first
+static uint32_t add_children(fqtree_t *fqtree, uint32_t node, const size_t splits[5]);
+/// Sum up every node of the tree when given a value function
+static void sum_tree(fqtree_t *fqtree, arena_t *arena, fqtree_value_fn_t value);
+/// Sum up the subtree of node, whose children have already been summed
+static void sum_node(fqtree_t *fqtree, uint32_t node, fqtree_value_fn_t value);
+/// Reorder items[beg..end] so those with a coordinate below pivot come first,
+/// returning where the rest begin
+static size_t partition(fqtree_t *fqtree, size_t beg, size_t end, bool by_x, float pivot);
+/// Bounds of child c (sw, se, nw, ne) of a node with the given bounds
+static rect_t child_bounds(rect_t bounds, size_t c);
+/// query_recursive, treating far subtrees as a point at their centre of mass
+static void far_recursive(
+  const fqtree_t *fqtree,
+  uint32_t node,
+  rect_t bounds,
+  rect_t range,
+  v2f_t origin,
+  float theta,
+  void **found,
+  size_t *found_count,
+  size_t capacity,
+  fqtree_aggregate_t *aggregate
+);
+/// Could a node with the given bounds hold an element at point? Allows for the
+/// Morton build filing elements up to one code cell across a quadrant boundary
+static bool may_hold(const fqtree_t *fqtree, rect_t bounds, v2f_t point);
+/// Fold the sums of node into aggregate
+static void aggregate_node(const fqtree_t *fqtree, uint32_t node, fqtree_aggregate_t *aggregate);
+/// Write the items of node falling into range (all of them if add_all) into found
+static void add_node(
+  const fqtree_t *fqtree,
+  const fqtree_node_t *node,
+  rect_t range,
+  bool add_all,
+  void **found,
+  size_t *found_count,
+  size_t capacity
+);
+/// Query node (with the given bounds) within range, filling found up to
+/// capacity but counting every match
+static void query_recursive(
+  const fqtree_t *fqtree,
+  uint32_t node,
+  rect_t bounds,
+  rect_t range,
+  void **found,
+  size_t *found_count,
+  size_t capacity
+);
+/// Offer the items of node (covering bounds) to nearest, children nearest to
+/// center first, skipping subtrees farther away than everything it holds
+static void nearest_recursive(
+  const fqtree_t *fqtree,
+  uint32_t node,
+  rect_t bounds,
+  v2f_t center,
+  nearest_t *nearest
+);
+/// query_recursive, folding far enough contained subtrees into aggregate
+static void aggregate_recursive(
+  const fqtree_t *fqtree,
+  uint32_t node,
+  rect_t bounds,
+  rect_t range,
+  v2f_t origin,
+  float min_sqr_dist,
+  void **found,
+  size_t *found_count,
+  size_t capacity,
+  fqtree_aggregate_t *aggregate
+);
+
+void fqtree_init(fqtree_t *fqtree, rect_t range, size_t leaf_capacity) {
+  assert(fqtree != NULL);
+  assert(leaf_capacity > 0);
+
+  fqtree->range = range;
+  fqtree->leaf_capacity = leaf_capacity;
+
+  fqtree->nodes_len = 0;
+  fqtree->nodes = NULL;
+  fqtree->sums = NULL;
+  fqtree->items_len = 0;
+  fqtree->items = NULL;
+  fqtree->points = NULL;
+}
+
+void fqtree_build(
+  fqtree_t *fqtree,
+  arena_t *arena,
+  void *elements,
+  size_t len,
+  size_t stride,
+  fqtree_point_fn_t point,
+  fqtree_value_fn_t value
+) {
+  assert(fqtree != NULL);
+  assert(arena != NULL);
+  assert(len <= UINT32_MAX);
+
+  fqtree->items = arena_alloc(arena, len*sizeof(void *));
+  fqtree->points = arena_alloc(arena, len*sizeof(v2f_t));
+  fqtree->nodes = arena_alloc(arena, max_nodes(len, fqtree->leaf_capacity)*sizeof(fqtree_node_t));
+  assert(fqtree->items != NULL && fqtree->points != NULL && fqtree->nodes != NULL);
+
+  // everything in range starts out in the root
+  fqtree->items_len = 0;
+  char *ele = elements;
+  for (size_t i = 0; i < len; ++i, ele += stride) {
+    v2f_t p = point(ele);
+    if (!rect_contains_point(fqtree->range, p)) {
+      continue;
+    }
+    fqtree->items[fqtree->items_len] = ele;
+    fqtree->points[fqtree->items_len] = p;
+    fqtree->items_len += 1;
+  }
+
+  fqtree->nodes_len = 1;
+  fqtree->nodes[0].first_child = 0;
+  fqtree->nodes[0].first = 0;
+  fqtree->nodes[0].len = (uint32_t) fqtree->items_len;
+
+  build_recursive(fqtree, 0, fqtree->range, 0);
+  assert(fqtree->nodes_len <= max_nodes(len, fqtree->leaf_capacity));
+
+  sum_tree(fqtree, arena, value);
+}
+
+void fqtree_build_morton(
+  fqtree_t *fqtree,
+  arena_t *arena,
+  tpool_t *pool,
+  size_t parts,
+  void *elements,
+  size_t len,
+  size_t stride,
+  fqtree_point_fn_t point,
+  fqtree_value_fn_t value
+) {
+  assert(fqtree != NULL);
+  assert(arena != NULL);
+  assert(pool != NULL);
+  assert(len <= UINT32_MAX);
+  // every level must have a quadrant digit to split on
+  assert(FQTREE_MAX_DEPTH <= MORTON_BITS);
+
+  uint32_t *codes = arena_alloc(arena, len*sizeof(uint32_t));
+  uint32_t *order = arena_alloc(arena, len*sizeof(uint32_t));
+  fqtree->items = arena_alloc(arena, len*sizeof(void *));
+  fqtree->points = arena_alloc(arena, len*sizeof(v2f_t));
+  fqtree->nodes = arena_alloc(arena, max_nodes(len, fqtree->leaf_capacity)*sizeof(fqtree_node_t));
+  assert(codes != NULL && order != NULL);
+  assert(fqtree->items != NULL && fqtree->points != NULL && fqtree->nodes != NULL);
+
+  size_t in_range = 0;
+  char *ele = elements;
+  for (size_t i = 0; i < len; ++i, ele += stride) {
+    v2f_t p = point(ele);
+    if (!rect_contains_point(fqtree->range, p)) {
+      continue;
+    }
+    codes[in_range] = morton_code(fqtree->range, p);
+    order[in_range] = (uint32_t) i;
+    in_range += 1;
+  }
+
+  morton_sort(pool, parts, arena, codes, order, in_range);
+
+  // lay the items out in Z-order, which makes every subtree a contiguous run
+  char *base = elements;
+  for (size_t i = 0; i < in_range; ++i) {
+    void *item = base + (size_t) order[i]*stride;
+    fqtree->items[i] = item;
+    fqtree->points[i] = point(item);
+  }
+  fqtree->items_len = in_range;
+
+  fqtree->nodes_len = 1;
+  fqtree->nodes[0].first_child = 0;
+  fqtree->nodes[0].first = 0;
+  fqtree->nodes[0].len = (uint32_t) fqtree->items_len;
+
+  build_sorted(fqtree, codes, 0, 0);
+  assert(fqtree->nodes_len <= max_nodes(len, fqtree->leaf_capacity));
+
+  sum_tree(fqtree, arena, value);
+}
+
+size_t fqtree_leaves(const fqtree_t *fqtree, arena_t *arena, fqtree_leaf_t **out) {
+  assert(fqtree != NULL);
+  assert(arena != NULL);
+  assert(out != NULL);
+
+  size_t len = 0;
+  for (size_t n = 0; n < fqtree->nodes_len; ++n) {
+    if (fqtree->nodes[n].first_child == 0 && fqtree->nodes[n].len > 0) {
+      len += 1;
+    }
+  }
+
+  fqtree_leaf_t *leaves = arena_alloc(arena, len*sizeof(fqtree_leaf_t));
+  assert(leaves != NULL);
+  size_t i = 0;
+  for (size_t n = 0; n < fqtree->nodes_len; ++n) {
+    const fqtree_node_t *node = &fqtree->nodes[n];
+    if (node->first_child == 0 && node->len > 0) {
+      leaves[i].first = node->first;
+      leaves[i].len = node->len;
+      i += 1;
+    }
+  }
+
+  *out = leaves;
+  return len;
+}
+
+size_t fqtree_query_into(
+  const fqtree_t *fqtree,
+  rect_t query_range,
+  void **found,
+  size_t capacity
+) {
+  assert(fqtree != NULL);
+  assert(found != NULL || capacity == 0);
+
+  size_t found_count = 0;
+  if (fqtree->nodes_len > 0) {
+    query_recursive(fqtree, 0, fqtree->range, query_range, found, &found_count, capacity);
+  }
+
+  return found_count;
+}
+
+size_t fqtree_query_aggregate(
+  const fqtree_t *fqtree,
+  rect_t query_range,
+  v2f_t origin,
+  float min_sqr_dist,
+  void **found,
+  size_t capacity,
+  fqtree_aggregate_t *aggregate
+) {
+  assert(fqtree != NULL);
+  assert(fqtree->sums != NULL || fqtree->nodes_len == 0);
+  assert(found != NULL || capacity == 0);
+  assert(aggregate != NULL);
+
+  size_t found_count = 0;
+  aggregate->count = 0;
+  aggregate->points = v2ff(0.0);
+  aggregate->values = v2ff(0.0);
+  if (fqtree->nodes_len > 0) {
+    aggregate_recursive(
+      fqtree,
+      0,
+      fqtree->range,
+      query_range,
+      origin,
+      min_sqr_dist,
+      found,
+      &found_count,
+      capacity,
+      aggregate
+    );
+  }
+
+  return found_count;
+}
+
+size_t fqtree_query_far(
+  const fqtree_t *fqtree,
+  rect_t query_range,
+  v2f_t origin,
+  float theta,
+  void **found,
+  size_t capacity,
+  fqtree_aggregate_t *aggregate
+) {
+  assert(fqtree != NULL);
+  assert(fqtree->sums != NULL || fqtree->nodes_len == 0);
+  assert(found != NULL || capacity == 0);
+  assert(aggregate != NULL);
+
+  size_t found_count = 0;
+  aggregate->count = 0;
+  aggregate->points = v2ff(0.0);
+  aggregate->values = v2ff(0.0);
+  if (fqtree->nodes_len > 0) {
+    far_recursive(
+      fqtree,
+      0,
+      fqtree->range,
+      query_range,
+      origin,
+      theta,
+      found,
+      &found_count,
+      capacity,
+      aggregate
+    );
+  }
+
+  return found_count;
+}
+
+size_t fqtree_query_nearest(
+  const fqtree_t *fqtree,
+  v2f_t center,
+  size_t k,
+  void **found,
+  float *sqr_dists
+) {
+  assert(fqtree != NULL);
+
+  nearest_t nearest;
+  nearest_init(&nearest, k, found, sqr_dists);
+  if (fqtree->nodes_len > 0 && k > 0) {
+    nearest_recursive(fqtree, 0, fqtree->range, center, &nearest);
+  }
+
+  return nearest_sort(&nearest);
+}
+
+static size_t max_nodes(size_t len, size_t leaf_capacity) {
+  // an internal node holds more than leaf_capacity elements and the nodes of a
+  // level are disjoint, so each level has at most len/(leaf_capacity + 1) of them
+  size_t internal = FQTREE_MAX_DEPTH*(len/(leaf_capacity + 1));
+  return 1 + 4*internal;
+}
+
+static void build_recursive(fqtree_t *fqtree, uint32_t node, rect_t bounds, size_t depth) {
+  assert(fqtree != NULL);
+  size_t beg = fqtree->nodes[node].first;
+  size_t end = beg + fqtree->nodes[node].len;
+  if (end - beg <= fqtree->leaf_capacity || depth >= FQTREE_MAX_DEPTH) {
+    // small (or deep) enough to stay a leaf
+    return;
+  }
+
+  // south before north, then west before east within each half
+  size_t mid = partition(fqtree, beg, end, false, bounds.center.y);
+  size_t south_mid = partition(fqtree, beg, mid, true, bounds.center.x);
+  size_t north_mid = partition(fqtree, mid, end, true, bounds.center.x);
+  size_t splits[5] = {beg, south_mid, mid, north_mid, end};
+
+  uint32_t first_child = add_children(fqtree, node, splits);
+  for (size_t c = 0; c < 4; ++c) {
+    build_recursive(fqtree, first_child + (uint32_t) c, child_bounds(bounds, c), depth + 1);
+  }
+}
+
+static void build_sorted(fqtree_t *fqtree, const uint32_t *codes, uint32_t node, size_t depth) {
+  assert(fqtree != NULL);
+  assert(codes != NULL);
+  size_t beg = fqtree->nodes[node].first;
+  size_t end = beg + fqtree->nodes[node].len;
+  if (end - beg <= fqtree->leaf_capacity || depth >= FQTREE_MAX_DEPTH) {
+    return;
+  }
+
+  // the codes of a node share every digit above its depth, so sorting them
+  // grouped them by the next digit, which is the child (sw, se, nw, ne) they
+  // fall into: y picks north or south, x picks east or west
+  size_t shift = 2*(MORTON_BITS - 1 - depth);
+  size_t splits[5] = {beg, 0, 0, 0, end};
+  for (uint32_t c = 1; c < 4; ++c) {
+    splits[c] = lower_digit(codes, splits[c - 1], end, shift, c);
+  }
+
+  uint32_t first_child = add_children(fqtree, node, splits);
+  for (size_t c = 0; c < 4; ++c) {
+    build_sorted(fqtree, codes, first_child + (uint32_t) c, depth + 1);
+  }
+}
+
+static size_t lower_digit(const uint32_t *codes, size_t beg, size_t end, size_t shift, uint32_t digit) {
+  while (beg < end) {
+    size_t mid = beg + (end - beg)/2;
+    if (((codes[mid] >> shift) & 3) < digit) {
+      beg = mid + 1;
+    } else {
+      end = mid;
+    }
+  }
+  return beg;
+}
+
+static uint32_t add_children(fqtree_t *fqtree, uint32_t node, const size_t splits[5]) {
+  assert(fqtree != NULL);
+  // children are allocated together so one index addresses all four
+  uint32_t first_child = (uint32_t) fqtree->nodes_len;
+  fqtree->nodes_len += 4;
+  fqtree->nodes[node].first_child = first_child;
+  for (size_t c = 0; c < 4; ++c) {
+    fqtree_node_t *child = &fqtree->nodes[first_child + c];
+    child->first_child = 0;
+    child->first = (uint32_t) splits[c];
+    child->len = (uint32_t) (splits[c + 1] - splits[c]);
+  }
+  return first_child;
+}
+
+static void sum_tree(fqtree_t *fqtree, arena_t *arena, fqtree_value_fn_t value) {
+  assert(fqtree != NULL);
+  fqtree->sums = NULL;
+  if (value == NULL) {
+    return;
+  }
+  fqtree->sums = arena_alloc(arena, fqtree->nodes_len*sizeof(fqtree_sums_t));
+  assert(fqtree->sums != NULL);
+  // children always come after their parent, so walking backwards sums
+  // every child before the node it belongs to
+  for (size_t n = fqtree->nodes_len; n > 0; --n) {
+    sum_node(fqtree, (uint32_t) (n - 1), value);
+  }
+}
+
+static void sum_node(fqtree_t *fqtree, uint32_t node, fqtree_value_fn_t value) {
+  assert(fqtree != NULL);
+  const fqtree_node_t *curr = &fqtree->nodes[node];
+  fqtree_sums_t sums = {0};
+
+  if (curr->first_child == 0) {
+    size_t end = (size_t) curr->first + curr->len;
+    for (size_t i = curr->first; i < end; ++i) {
+      sums.points = v2f_add(sums.points, fqtree->points[i]);
+      sums.values = v2f_add(sums.values, value(fqtree->items[i]));
+    }
+  } else {
+    for (uint32_t c = 0; c < 4; ++c) {
+      const fqtree_sums_t *child = &fqtree->sums[curr->first_child + c];
+      sums.points = v2f_add(sums.points, child->points);
+      sums.values = v2f_add(sums.values, child->values);
+    }
+  }
+
+  fqtree->sums[node] = sums;
+}
+
+static size_t partition(fqtree_t *fqtree, size_t beg, size_t end, bool by_x, float pivot) {
+  assert(fqtree != NULL);
+  void **items = fqtree->items;
+  v2f_t *points = fqtree->points;
+
+  size_t i = beg;
+  for (size_t j = beg; j < end; ++j) {
+    float coord = by_x ? points[j].x : points[j].y;
+    if (coord < pivot) {
+      void *item = items[i];
+      v2f_t p = points[i];
+      items[i] = items[j];
+      points[i] = points[j];
+      items[j] = item;
+      points[j] = p;
+      ++i;
+    }
+  }
+
+  return i;
+}
+
+static rect_t child_bounds(rect_t bounds, size_t c) {
+  float hw = bounds.half_width/2.0;
+  float hh = bounds.half_height/2.0;
+  float x = (c & 1) ? bounds.center.x + hw : bounds.center.x - hw;
+  float y = (c & 2) ? bounds.center.y + hh : bounds.center.y - hh;
+  return rect_new(v2f(x, y), hw, hh);
+}
+
+static void query_recursive(
+  const fqtree_t *fqtree,
+  uint32_t node,
+  rect_t bounds,
+  rect_t range,
+  void **found,
+  size_t *found_count,
+  size_t capacity
+) {
+  assert(fqtree != NULL);
+  const fqtree_node_t *curr = &fqtree->nodes[node];
+
+  if (curr->len == 0 || !rect_intersects(bounds, range)) {
+    // we have nothing to check, return immediately
+    return;
+  }
+
+  // our whole subtree is one contiguous run of items, so if we are entirely
+  // within the query there is no need to descend any further
+  bool add_all = rect_is_inside(bounds, range);
+  if (add_all || curr->first_child == 0) {
+    add_node(fqtree, curr, range, add_all, found, found_count, capacity);
+    return;
+  }
+
+  for (size_t c = 0; c < 4; ++c) {
+    query_recursive(
+      fqtree,
+      curr->first_child + (uint32_t) c,
+      child_bounds(bounds, c),
+      range,
+      found,
+      found_count,
+      capacity
+    );
+  }
+}
+
+static void nearest_recursive(
+  const fqtree_t *fqtree,
+  uint32_t node,
+  rect_t bounds,
+  v2f_t center,
+  nearest_t *nearest
+) {
+  assert(fqtree != NULL);
+  const fqtree_node_t *curr = &fqtree->nodes[node];
+
+  if (curr->first_child == 0) {
+    for (uint32_t i = curr->first; i < curr->first + curr->len; ++i) {
+      nearest_offer(nearest, fqtree->items[i], v2f_sqr_len(v2f_sub(fqtree->points[i], center)));
+    }
+    return;
+  }
+
+  // the quadrant holding center first, so the bound tightens as early as it can
+  size_t order[4];
+  rect_t child_ranges[4];
+  float sqr_dists[4];
+  for (size_t c = 0; c < 4; ++c) {
+    child_ranges[c] = child_bounds(bounds, c);
+    sqr_dists[c] = rect_min_sqr_dist(child_ranges[c], center);
+    size_t j = c;
+    for (; j > 0 && sqr_dists[order[j - 1]] > sqr_dists[c]; --j) {
+      order[j] = order[j - 1];
+    }
+    order[j] = c;
+  }
+
+  for (size_t i = 0; i < 4; ++i) {
+    size_t c = order[i];
+    if (sqr_dists[c] >= nearest_bound(nearest)) {
+      // neither this quadrant nor any farther one can hold anything nearer
+      return;
+    }
+    if (fqtree->nodes[curr->first_child + c].len > 0) {
+      nearest_recursive(fqtree, curr->first_child + (uint32_t) c, child_ranges[c], center, nearest);
+    }
+  }
+}
+
+static void aggregate_recursive(
+  const fqtree_t *fqtree,
+  uint32_t node,
+  rect_t bounds,
+  rect_t range,
+  v2f_t origin,
+  float min_sqr_dist,
+  void **found,
+  size_t *found_count,
+  size_t capacity,
+  fqtree_aggregate_t *aggregate
+) {
+  assert(fqtree != NULL);
+  const fqtree_node_t *curr = &fqtree->nodes[node];
+
+  if (curr->len == 0 || !rect_intersects(bounds, range)) {
+    return;
+  }
+
+  bool add_all = rect_is_inside(bounds, range);
+  if (add_all && rect_min_sqr_dist(bounds, origin) >= min_sqr_dist) {
+    // far enough that the caller only wants totals, which we already have
+    aggregate_node(fqtree, node, aggregate);
+    return;
+  }
+
+  if (curr->first_child == 0) {
+    add_node(fqtree, curr, range, add_all, found, found_count, capacity);
+    return;
+  }
+
+  for (size_t c = 0; c < 4; ++c) {
+    aggregate_recursive(
+      fqtree,
+      curr->first_child + (uint32_t) c,
+      child_bounds(bounds, c),
+      range,
+      origin,
+      min_sqr_dist,
+      found,
+      found_count,
+      capacity,
+      aggregate
+    );
+  }
+}
+
+static void add_node(
+  const fqtree_t *fqtree,
+  const fqtree_node_t *node,
+  rect_t range,
+  bool add_all,
+  void **found,
+  size_t *found_count,
+  size_t capacity
+) {
+  assert(fqtree != NULL);
+  size_t end = (size_t) node->first + node->len;
+  for (size_t i = node->first; i < end; ++i) {
+    if (add_all || rect_contains_point(range, fqtree->points[i])) {
+      // keep counting past capacity so the caller knows how much room we need
+      if (*found_count < capacity) {
+        found[*found_count] = fqtree->items[i];
+      }
+      *found_count += 1;
+    }
+  }
+}
+
+static void far_recursive(
+  const fqtree_t *fqtree,
+  uint32_t node,
+  rect_t bounds,
+  rect_t range,
+  v2f_t origin,
+  float theta,
+  void **found,
+  size_t *found_count,
+  size_t capacity,
+  fqtree_aggregate_t *aggregate
+) {
+  assert(fqtree != NULL);
+  const fqtree_node_t *curr = &fqtree->nodes[node];
+
+  if (curr->len == 0 || !rect_intersects(bounds, range)) {
+    return;
+  }
+
+  // the querying boid (and whoever shares its position) is counted but adds
+  // nothing to the rules, which node totals can't leave out, so any node that
+  // may hold origin is opened up instead of aggregated
+  bool holds_origin = may_hold(fqtree, bounds, origin);
+
+  if (!holds_origin && rect_is_inside(bounds, range)) {
+    // totals of a subtree we fully cover (and that doesn't hold origin) are exact
+    aggregate_node(fqtree, node, aggregate);
+    return;
+  }
+
+  // opening criterion: small enough relative to its distance to be a point
+  v2f_t com = v2f_div(fqtree->sums[node].points, v2ff((float) curr->len));
+  float size = 2.0f*(bounds.half_width > bounds.half_height ? bounds.half_width : bounds.half_height);
+  float sqr_dist = v2f_sqr_len(v2f_sub(com, origin));
+  if (!holds_origin && size*size < theta*theta*sqr_dist) {
+    if (rect_contains_point(range, com)) {
+      aggregate_node(fqtree, node, aggregate);
+    }
+    return;
+  }
+
+  if (curr->first_child == 0) {
+    add_node(fqtree, curr, range, false, found, found_count, capacity);
+    return;
+  }
+
+  for (size_t c = 0; c < 4; ++c) {
+    far_recursive(
+      fqtree,
+      curr->first_child + (uint32_t) c,
+      child_bounds(bounds, c),
+      range,
+      origin,
+      theta,
+      found,
+      found_count,
+      capacity,
+      aggregate
+    );
+  }
+}
+
+static bool may_hold(const fqtree_t *fqtree, rect_t bounds, v2f_t point) {
+  float slack_x = 2.0f*fqtree->range.half_width/(float) (1u << MORTON_BITS);
+  float slack_y = 2.0f*fqtree->range.half_height/(float) (1u << MORTON_BITS);
+  return rect_contains_point(rect_new(bounds.center, bounds.half_width + slack_x, bounds.half_height + slack_y), point);
+}
+
+static void aggregate_node(const fqtree_t *fqtree, uint32_t node, fqtree_aggregate_t *aggregate) {
+  assert(fqtree != NULL);
+  const fqtree_sums_t *sums = &fqtree->sums[node];
+  aggregate->count += fqtree->nodes[node].len;
+  aggregate->points = v2f_add(aggregate->points, sums->points);
+  aggregate->values = v2f_add(aggregate->values, sums->values);
+}
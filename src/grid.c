@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "rect.h"
+#include "grid.h"
+
+/// Column of the grid x falls into, clamped to the grid
+static size_t col_of(grid_t *grid, float x);
+/// Row of the grid y falls into, clamped to the grid
+static size_t row_of(grid_t *grid, float y);
+
+void grid_init(grid_t *grid, rect_t range, float cell_width, float cell_height) {
+  assert(grid != NULL);
+  assert(cell_width > 0.0 && cell_height > 0.0);
+
+  grid->range = range;
+  grid->cell_width = cell_width;
+  grid->cell_height = cell_height;
+  grid->cols = (size_t) ceilf((2.0*range.half_width)/cell_width);
+  grid->rows = (size_t) ceilf((2.0*range.half_height)/cell_height);
+  if (grid->cols == 0) grid->cols = 1;
+  if (grid->rows == 0) grid->rows = 1;
+
+  grid->cell_start = NULL;
+  grid->items_len = 0;
+  grid->items = NULL;
+  grid->points = NULL;
+}
+
+void grid_build(
+  grid_t *grid,
+  arena_t *arena,
+  void *elements,
+  size_t len,
+  size_t stride,
+  grid_point_fn_t point
+) {
+  assert(grid != NULL);
+  assert(arena != NULL);
+
+  size_t cells = grid->cols*grid->rows;
+  grid->cell_start = arena_alloc(arena, (cells + 1)*sizeof(size_t));
+  grid->items = arena_alloc(arena, len*sizeof(void *));
+  grid->points = arena_alloc(arena, len*sizeof(v2f_t));
+  grid->items_len = len;
+  size_t *cell_of = arena_alloc(arena, len*sizeof(size_t));
+  assert(grid->cell_start != NULL && grid->items != NULL && grid->points != NULL);
+  assert(cell_of != NULL);
+
+  for (size_t c = 0; c <= cells; ++c) {
+    grid->cell_start[c] = 0;
+  }
+
+  // count elements per cell, offset by one so the prefix sum yields starts
+  char *ele = elements;
+  for (size_t i = 0; i < len; ++i, ele += stride) {
+    v2f_t p = point(ele);
+    cell_of[i] = row_of(grid, p.y)*grid->cols + col_of(grid, p.x);
+    grid->cell_start[cell_of[i] + 1] += 1;
+  }
+
+  for (size_t c = 0; c < cells; ++c) {
+    grid->cell_start[c + 1] += grid->cell_start[c];
+  }
+
+  // scatter into place, cell_start[c] is used as a cursor and restored after
+  ele = elements;
+  for (size_t i = 0; i < len; ++i, ele += stride) {
+    size_t slot = grid->cell_start[cell_of[i]]++;
+    grid->items[slot] = ele;
+    grid->points[slot] = point(ele);
+  }
+
+  for (size_t c = cells; c > 0; --c) {
+    grid->cell_start[c] = grid->cell_start[c - 1];
+  }
+  grid->cell_start[0] = 0;
+}
+
+void **grid_query(grid_t *grid, rect_t query_range, size_t *out_count) {
+  assert(grid != NULL);
+
+  size_t found_capacity = 16;
+  void **found = calloc(found_capacity, sizeof(void *));
+  assert(found != NULL);
+
+  // retry once with an exact fit if we overflowed
+  *out_count = grid_query_into(grid, query_range, found, found_capacity);
+  if (*out_count > found_capacity) {
+    found_capacity = *out_count;
+    found = realloc(found, sizeof(void *) * found_capacity);
+    assert(found != NULL);
+    grid_query_into(grid, query_range, found, found_capacity);
+  }
+
+  return found;
+}
+
+size_t grid_query_into(grid_t *grid, rect_t query_range, void **found, size_t capacity) {
+  assert(grid != NULL);
+  assert(found != NULL || capacity == 0);
+
+  size_t found_count = 0;
+  if (!rect_intersects(grid->range, query_range)) {
+    return found_count;
+  }
+
+  size_t col_beg = col_of(grid, query_range.center.x - query_range.half_width);
+  size_t col_end = col_of(grid, query_range.center.x + query_range.half_width);
+  size_t row_beg = row_of(grid, query_range.center.y - query_range.half_height);
+  size_t row_end = row_of(grid, query_range.center.y + query_range.half_height);
+
+  for (size_t row = row_beg; row <= row_end; ++row) {
+    // cells of a row are adjacent, so the whole span is one contiguous range
+    size_t beg = grid->cell_start[row*grid->cols + col_beg];
+    size_t end = grid->cell_start[row*grid->cols + col_end + 1];
+    for (size_t i = beg; i < end; ++i) {
+      if (!rect_contains_point(query_range, grid->points[i])) {
+        continue;
+      }
+      // keep counting past capacity so the caller knows how much room we need
+      if (found_count < capacity) {
+        found[found_count] = grid->items[i];
+      }
+      found_count += 1;
+    }
+  }
+
+  return found_count;
+}
+
+static size_t col_of(grid_t *grid, float x) {
+  float offset = x - (grid->range.center.x - grid->range.half_width);
+  if (offset <= 0.0) return 0;
+  size_t col = (size_t) (offset/grid->cell_width);
+  return col < grid->cols ? col : grid->cols - 1;
+}
+
+static size_t row_of(grid_t *grid, float y) {
+  float offset = y - (grid->range.center.y - grid->range.half_height);
+  if (offset <= 0.0) return 0;
+  size_t row = (size_t) (offset/grid->cell_height);
+  return row < grid->rows ? row : grid->rows - 1;
+}
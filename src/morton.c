@@ -0,0 +1,143 @@
+#include <assert.h>
+
+#include "morton.h"
+
+#define RADIX_BITS (8)
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_PASSES (32/RADIX_BITS)
+
+/// A unit of work to perform on another thread; one part of one radix pass,
+/// either counting digits of src[start..end] or scattering them into dst
+typedef struct {
+  const uint32_t *src_codes; // READ ONLY
+  const uint32_t *src_order; // READ ONLY
+  uint32_t *dst_codes; // WRITE ONLY (only at this part's offsets)
+  uint32_t *dst_order; // WRITE ONLY (only at this part's offsets)
+  size_t start;
+  size_t end;
+  size_t shift;
+  // digit counts after counting, then where each digit goes while scattering
+  size_t *offsets;
+} radix_task_t;
+
+/// Spread the low bits of x out to every other bit
+static uint32_t spread_bits(uint32_t x);
+/// Quantize v in [lo, lo + extent] onto 0..2^MORTON_BITS - 1
+static uint32_t quantize(float v, float lo, float extent);
+/// The thread_func_t counting digits of one part
+static void chunk_radix_count(void *arg);
+/// The thread_func_t scattering one part into place
+static void chunk_radix_scatter(void *arg);
+
+uint32_t morton_encode(uint32_t x, uint32_t y) {
+  return spread_bits(x) | (spread_bits(y) << 1);
+}
+
+uint32_t morton_code(rect_t range, v2f_t p) {
+  float left = range.center.x - range.half_width;
+  float top = range.center.y - range.half_height;
+  uint32_t x = quantize(p.x, left, 2.0*range.half_width);
+  uint32_t y = quantize(p.y, top, 2.0*range.half_height);
+  return morton_encode(x, y);
+}
+
+void morton_sort(
+  tpool_t *pool,
+  size_t parts,
+  arena_t *arena,
+  uint32_t *codes,
+  uint32_t *order,
+  size_t len
+) {
+  assert(pool != NULL);
+  assert(arena != NULL);
+  if (parts == 0) parts = 1;
+  if (parts > len) parts = len;
+  if (len < 2) return;
+
+  uint32_t *tmp_codes = arena_alloc(arena, len*sizeof(uint32_t));
+  uint32_t *tmp_order = arena_alloc(arena, len*sizeof(uint32_t));
+  radix_task_t *tasks = arena_alloc(arena, parts*sizeof(radix_task_t));
+  size_t *offsets = arena_alloc(arena, parts*RADIX_SIZE*sizeof(size_t));
+  assert(tmp_codes != NULL && tmp_order != NULL);
+  assert(tasks != NULL && offsets != NULL);
+
+  uint32_t *src_codes = codes, *src_order = order;
+  uint32_t *dst_codes = tmp_codes, *dst_order = tmp_order;
+
+  // an even number of passes leaves the result back in codes/order
+  for (size_t pass = 0; pass < RADIX_PASSES; ++pass) {
+    for (size_t p = 0; p < parts; ++p) {
+      tasks[p].src_codes = src_codes;
+      tasks[p].src_order = src_order;
+      tasks[p].dst_codes = dst_codes;
+      tasks[p].dst_order = dst_order;
+      tasks[p].start = (len*p)/parts;
+      tasks[p].end = (len*(p + 1))/parts;
+      tasks[p].shift = pass*RADIX_BITS;
+      tasks[p].offsets = &offsets[p*RADIX_SIZE];
+      tpool_add_work(pool, chunk_radix_count, &tasks[p]);
+    }
+    tpool_wait(pool);
+
+    // digit-major, part-minor prefix sum keeps equal digits in input order
+    size_t running = 0;
+    for (size_t d = 0; d < RADIX_SIZE; ++d) {
+      for (size_t p = 0; p < parts; ++p) {
+        size_t count = tasks[p].offsets[d];
+        tasks[p].offsets[d] = running;
+        running += count;
+      }
+    }
+
+    for (size_t p = 0; p < parts; ++p) {
+      tpool_add_work(pool, chunk_radix_scatter, &tasks[p]);
+    }
+    tpool_wait(pool);
+
+    uint32_t *swap_codes = src_codes, *swap_order = src_order;
+    src_codes = dst_codes;
+    src_order = dst_order;
+    dst_codes = swap_codes;
+    dst_order = swap_order;
+  }
+}
+
+static uint32_t spread_bits(uint32_t x) {
+  x &= 0x0000ffff;
+  x = (x | (x << 8)) & 0x00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+
+static uint32_t quantize(float v, float lo, float extent) {
+  uint32_t max = (1u << MORTON_BITS) - 1;
+  if (extent <= 0.0) return 0;
+  float t = (v - lo)/extent;
+  if (!(t > 0.0)) return 0; // also catches nan
+  if (t >= 1.0) return max;
+  return (uint32_t) (t*(float) (max + 1));
+}
+
+static void chunk_radix_count(void *arg) {
+  assert(arg != NULL);
+  radix_task_t *task = (radix_task_t *)arg;
+  for (size_t d = 0; d < RADIX_SIZE; ++d) {
+    task->offsets[d] = 0;
+  }
+  for (size_t i = task->start; i < task->end; ++i) {
+    task->offsets[(task->src_codes[i] >> task->shift) & (RADIX_SIZE - 1)] += 1;
+  }
+}
+
+static void chunk_radix_scatter(void *arg) {
+  assert(arg != NULL);
+  radix_task_t *task = (radix_task_t *)arg;
+  for (size_t i = task->start; i < task->end; ++i) {
+    size_t slot = task->offsets[(task->src_codes[i] >> task->shift) & (RADIX_SIZE - 1)]++;
+    task->dst_codes[slot] = task->src_codes[i];
+    task->dst_order[slot] = task->src_order[i];
+  }
+}
@@ -0,0 +1,86 @@
+#include <math.h>
+#include <assert.h>
+
+#include "nearest.h"
+
+/// Swap entries i and j of nearest
+static void swap_entries(nearest_t *nearest, size_t i, size_t j);
+/// Move entry i down the first len entries until the heap property holds again
+static void sift_down(nearest_t *nearest, size_t i, size_t len);
+
+void nearest_init(nearest_t *nearest, size_t k, void **eles, float *sqr_dists) {
+  assert(nearest != NULL);
+  assert(k == 0 || (eles != NULL && sqr_dists != NULL));
+  nearest->k = k;
+  nearest->len = 0;
+  nearest->eles = eles;
+  nearest->sqr_dists = sqr_dists;
+}
+
+float nearest_bound(const nearest_t *nearest) {
+  assert(nearest != NULL);
+  if (nearest->len < nearest->k) {
+    return INFINITY;
+  }
+  return nearest->k > 0 ? nearest->sqr_dists[0] : -INFINITY;
+}
+
+bool nearest_offer(nearest_t *nearest, void *ele, float sqr_dist) {
+  assert(nearest != NULL);
+  if (nearest->len < nearest->k) {
+    // still room, sift the new entry up from the bottom
+    size_t i = nearest->len++;
+    nearest->eles[i] = ele;
+    nearest->sqr_dists[i] = sqr_dist;
+    while (i > 0 && nearest->sqr_dists[(i - 1)/2] < nearest->sqr_dists[i]) {
+      swap_entries(nearest, i, (i - 1)/2);
+      i = (i - 1)/2;
+    }
+    return true;
+  }
+
+  if (nearest->k == 0 || sqr_dist >= nearest->sqr_dists[0]) {
+    return false;
+  }
+  nearest->eles[0] = ele;
+  nearest->sqr_dists[0] = sqr_dist;
+  sift_down(nearest, 0, nearest->len);
+  return true;
+}
+
+size_t nearest_sort(nearest_t *nearest) {
+  assert(nearest != NULL);
+  // heapsort: the farthest goes to the back, and the heap shrinks around it
+  for (size_t end = nearest->len; end > 1; --end) {
+    swap_entries(nearest, 0, end - 1);
+    sift_down(nearest, 0, end - 1);
+  }
+  return nearest->len;
+}
+
+static void swap_entries(nearest_t *nearest, size_t i, size_t j) {
+  void *ele = nearest->eles[i];
+  nearest->eles[i] = nearest->eles[j];
+  nearest->eles[j] = ele;
+  float sqr_dist = nearest->sqr_dists[i];
+  nearest->sqr_dists[i] = nearest->sqr_dists[j];
+  nearest->sqr_dists[j] = sqr_dist;
+}
+
+static void sift_down(nearest_t *nearest, size_t i, size_t len) {
+  for (;;) {
+    size_t largest = i;
+    size_t left = 2*i + 1, right = 2*i + 2;
+    if (left < len && nearest->sqr_dists[left] > nearest->sqr_dists[largest]) {
+      largest = left;
+    }
+    if (right < len && nearest->sqr_dists[right] > nearest->sqr_dists[largest]) {
+      largest = right;
+    }
+    if (largest == i) {
+      return;
+    }
+    swap_entries(nearest, i, largest);
+    i = largest;
+  }
+}
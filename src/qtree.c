@@ -3,18 +3,51 @@
 
 #include "rect.h"
 #include "qtree.h"
+#include "nearest.h"
 
 /// Returns if a qtree has previously been subdivided
 static bool is_subdivided(qtree_t *qtree);
 /// Subdivide a qtree into its 4 quadrants
 static void subdivide(qtree_t *qtree, arena_t *arena);
-/// Query qtree within a given range, filling and growing found data as needed 
+/// Double the room in the data of a qtree at QTREE_MAX_DEPTH
+static void grow_data(qtree_t *qtree, arena_t *arena);
+/// Record in the tree's stats (if counting) that qtree stores an element
+static void note_depth(qtree_t *qtree);
+/// Query qtree within radius of center (sqr_radius being its square), filling
+/// found up to found_capacity but counting every match
+static void radius_recursive(
+  qtree_t *qtree,
+  v2f_t center,
+  float sqr_radius,
+  qtree_point_fn_t point,
+  void **found,
+  size_t *found_count,
+  size_t found_capacity
+);
+/// Offer the elements of qtree and its subtree to nearest, children nearest
+/// to center first, skipping nodes farther away than everything it holds
+static void nearest_recursive(qtree_t *qtree, v2f_t center, qtree_point_fn_t point, nearest_t *nearest);
+/// Update qtree and its subtree, leaving elements it can't hold at the end of
+/// pending, returning how many elements the subtree holds
+static size_t update_recursive(
+  qtree_t *qtree,
+  arena_t *arena,
+  size_t merge_len,
+  qtree_pending_t *pending,
+  qtree_update_stats_t *stats
+);
+/// Append every element of qtree's subtree to out, counting the nodes visited
+static void gather_recursive(qtree_t *qtree, void **out, size_t *out_len, size_t *nodes);
+/// Push an element onto pending, growing it if needed
+static void pending_push(qtree_pending_t *pending, void *ele);
+/// Query qtree within a given range, filling found up to found_capacity but
+/// counting every match
 static void query_recursive(
   qtree_t *qtree, 
   rect_t range, 
-  void ***found,
+  void **found,
   size_t *found_count,
-  size_t *found_capacity
+  size_t found_capacity
 );
 
 qtree_t *qtree_new(
@@ -31,11 +64,14 @@ qtree_t *qtree_new(
 
   qtree->check_range = check_range;
   qtree->range = range;
+  qtree->depth = 0;
 
   qtree->capacity = capacity;
   qtree->data_len = 0;
+  qtree->data_capacity = capacity;
   qtree->data = arena_alloc(arena, capacity*sizeof(void *));
   assert(qtree->data != NULL);
+  qtree->stats = NULL;
 
   qtree->ne = NULL;
   qtree->se = NULL;
@@ -54,6 +90,21 @@ bool qtree_insert(qtree_t *qtree, arena_t *arena, void *ele) {
 
   if (qtree->data_len < qtree->capacity) {
     qtree->data[qtree->data_len++] = ele;
+    note_depth(qtree);
+    return true;
+  }
+
+  if (qtree->depth >= QTREE_MAX_DEPTH) {
+    // many elements sharing (nearly) a point would otherwise subdivide for as
+    // long as floats can split the range, so stay a leaf and overflow instead
+    if (qtree->data_len == qtree->data_capacity) {
+      grow_data(qtree, arena);
+    }
+    qtree->data[qtree->data_len++] = ele;
+    note_depth(qtree);
+    if (qtree->stats != NULL) {
+      atomic_fetch_add_explicit(&qtree->stats->overflows, 1, memory_order_relaxed);
+    }
     return true;
   }
 
@@ -68,19 +119,186 @@ bool qtree_insert(qtree_t *qtree, arena_t *arena, void *ele) {
           qtree_insert(qtree->nw, arena, ele));
 }
 
+bool qtree_split(
+  qtree_t *qtree,
+  arena_t *arena,
+  void **eles,
+  size_t len,
+  void **out,
+  size_t child_lens[4]
+) {
+  assert(qtree != NULL);
+  assert(qtree->data_len == 0 && !is_subdivided(qtree));
+
+  for (size_t c = 0; c < 4; ++c) {
+    child_lens[c] = 0;
+  }
+
+  // the first elements in range stay with us, just like qtree_insert
+  size_t i = 0;
+  for (; i < len && qtree->data_len < qtree->capacity; ++i) {
+    if ((qtree->check_range)(eles[i], qtree->range)) {
+      qtree->data[qtree->data_len++] = eles[i];
+    }
+  }
+  if (qtree->data_len > 0) {
+    note_depth(qtree);
+  }
+  if (i == len) {
+    return false;
+  }
+
+  if (qtree->depth >= QTREE_MAX_DEPTH) {
+    // we can't subdivide, so everything left in range overflows into us
+    for (; i < len; ++i) {
+      qtree_insert(qtree, arena, eles[i]);
+    }
+    return false;
+  }
+
+  subdivide(qtree, arena);
+  qtree_t *children[4] = {qtree->ne, qtree->se, qtree->sw, qtree->nw};
+
+  // remember which child takes each leftover (4 meaning none), then count
+  size_t rest = len - i;
+  unsigned char *route = arena_alloc(arena, rest);
+  assert(route != NULL);
+  for (size_t j = 0; j < rest; ++j) {
+    void *ele = eles[i + j];
+    route[j] = 4;
+    if (!(qtree->check_range)(ele, qtree->range)) {
+      continue;
+    }
+    // first child to accept wins, same order qtree_insert tries them in
+    for (unsigned char c = 0; c < 4; ++c) {
+      if ((children[c]->check_range)(ele, children[c]->range)) {
+        route[j] = c;
+        child_lens[c] += 1;
+        break;
+      }
+    }
+  }
+
+  // stable scatter into per-child groups
+  size_t offsets[4] = {0};
+  for (size_t c = 1; c < 4; ++c) {
+    offsets[c] = offsets[c - 1] + child_lens[c - 1];
+  }
+  for (size_t j = 0; j < rest; ++j) {
+    if (route[j] < 4) {
+      out[offsets[route[j]]++] = eles[i + j];
+    }
+  }
+
+  return true;
+}
+
+size_t qtree_query_radius_into(
+  qtree_t *qtree,
+  v2f_t center,
+  float radius,
+  qtree_point_fn_t point,
+  void **found,
+  size_t capacity
+) {
+  assert(qtree != NULL);
+  assert(point != NULL);
+  assert(found != NULL || capacity == 0);
+
+  size_t found_count = 0;
+  radius_recursive(qtree, center, radius*radius, point, found, &found_count, capacity);
+
+  return found_count;
+}
+
+size_t qtree_query_nearest(
+  qtree_t *qtree,
+  v2f_t center,
+  size_t k,
+  qtree_point_fn_t point,
+  void **found,
+  float *sqr_dists
+) {
+  assert(qtree != NULL);
+  assert(point != NULL);
+
+  nearest_t nearest;
+  nearest_init(&nearest, k, found, sqr_dists);
+  if (k > 0) {
+    nearest_recursive(qtree, center, point, &nearest);
+  }
+
+  return nearest_sort(&nearest);
+}
+
+qtree_update_stats_t qtree_update(
+  qtree_t *qtree,
+  arena_t *arena,
+  size_t merge_len,
+  qtree_pending_t *pending
+) {
+  assert(qtree != NULL);
+  assert(pending != NULL);
+  assert(merge_len <= qtree->capacity);
+
+  // keep whatever room earlier updates grew
+  pending->len = 0;
+  qtree_update_stats_t stats = {0};
+  stats.len = update_recursive(qtree, arena, merge_len, pending, &stats);
+
+  // whatever the root couldn't take back is outside the tree entirely
+  stats.dropped = pending->len;
+
+  return stats;
+}
+
+void qtree_pending_free(qtree_pending_t *pending) {
+  assert(pending != NULL);
+  free(pending->eles);
+  pending->eles = NULL;
+  pending->len = 0;
+  pending->capacity = 0;
+}
+
+void qtree_count_inserts(qtree_t *qtree, qtree_insert_stats_t *stats) {
+  assert(qtree != NULL);
+  assert(stats != NULL);
+  assert(qtree->data_len == 0 && !is_subdivided(qtree));
+  atomic_init(&stats->overflows, 0);
+  atomic_init(&stats->grows, 0);
+  atomic_init(&stats->max_depth, 0);
+  qtree->stats = stats;
+}
+
 void **qtree_query(qtree_t *qtree, rect_t query_range, size_t *out_count) {
   assert(qtree != NULL);
 
   size_t found_capacity = 16;
   void **found = calloc(found_capacity, sizeof(void *));
   assert(found != NULL);
-  *out_count = 0;
 
-  query_recursive(qtree, query_range, &found, out_count, &found_capacity);
+  // retry once with an exact fit if we overflowed
+  *out_count = qtree_query_into(qtree, query_range, found, found_capacity);
+  if (*out_count > found_capacity) {
+    found_capacity = *out_count;
+    found = realloc(found, sizeof(void *) * found_capacity);
+    assert(found != NULL);
+    qtree_query_into(qtree, query_range, found, found_capacity);
+  }
 
   return found;
 }
 
+size_t qtree_query_into(qtree_t *qtree, rect_t query_range, void **found, size_t capacity) {
+  assert(qtree != NULL);
+  assert(found != NULL || capacity == 0);
+
+  size_t found_count = 0;
+  query_recursive(qtree, query_range, found, &found_count, capacity);
+
+  return found_count;
+}
+
 static bool is_subdivided(qtree_t *qtree) {
   assert(qtree != NULL);
   return qtree->ne != NULL;
@@ -96,14 +314,52 @@ static void subdivide(qtree_t *qtree, arena_t *arena) {
   qtree->se = qtree_new(arena, qtree->capacity, se, qtree->check_range);
   qtree->sw = qtree_new(arena, qtree->capacity, sw, qtree->check_range);
   qtree->nw = qtree_new(arena, qtree->capacity, nw, qtree->check_range);
+
+  qtree->ne->depth = qtree->depth + 1;
+  qtree->se->depth = qtree->depth + 1;
+  qtree->sw->depth = qtree->depth + 1;
+  qtree->nw->depth = qtree->depth + 1;
+
+  qtree->ne->stats = qtree->stats;
+  qtree->se->stats = qtree->stats;
+  qtree->sw->stats = qtree->stats;
+  qtree->nw->stats = qtree->stats;
+}
+
+static void grow_data(qtree_t *qtree, arena_t *arena) {
+  assert(qtree != NULL);
+  // the old array stays behind in the arena until it is cleared
+  size_t data_capacity = 2*qtree->data_capacity;
+  void **data = arena_alloc(arena, data_capacity*sizeof(void *));
+  assert(data != NULL);
+  for (size_t i = 0; i < qtree->data_len; ++i) {
+    data[i] = qtree->data[i];
+  }
+  qtree->data = data;
+  qtree->data_capacity = data_capacity;
+  if (qtree->stats != NULL) {
+    atomic_fetch_add_explicit(&qtree->stats->grows, 1, memory_order_relaxed);
+  }
+}
+
+static void note_depth(qtree_t *qtree) {
+  if (qtree->stats == NULL) {
+    return;
+  }
+  // mostly a plain load, the maximum only moves while the tree deepens
+  size_t seen = atomic_load_explicit(&qtree->stats->max_depth, memory_order_relaxed);
+  while (qtree->depth > seen && !atomic_compare_exchange_weak_explicit(
+    &qtree->stats->max_depth, &seen, qtree->depth, memory_order_relaxed, memory_order_relaxed
+  )) {
+  }
 }
 
 static void query_recursive(
   qtree_t *qtree, 
   rect_t range, 
-  void ***found,
+  void **found,
   size_t *found_count,
-  size_t *found_capacity
+  size_t found_capacity
 ) {
   assert(qtree != NULL);
 
@@ -116,14 +372,11 @@ static void query_recursive(
   bool add_all = rect_is_inside(qtree->range, range);
   for (size_t i = 0; i < qtree->data_len; ++i) {
     if (add_all || (qtree->check_range)(qtree->data[i], range)) {
-      // dynamic resize
-      if (*found_count + 1 > *found_capacity) {
-        *found_capacity *= 2;
-        // *found = arena_realloc(arena, *found, *found_capacity * sizeof(void *));
-        *found = realloc(*found, sizeof(void *) * (*found_capacity));
-        assert(*found != NULL);
+      // keep counting past capacity so the caller knows how much room we need
+      if (*found_count < found_capacity) {
+        found[*found_count] = qtree->data[i];
       }
-      (*found)[(*found_count)++] = qtree->data[i];
+      *found_count += 1;
     }
   }
 
@@ -134,4 +387,159 @@ static void query_recursive(
     query_recursive(qtree->sw, range, found, found_count, found_capacity);
     query_recursive(qtree->nw, range, found, found_count, found_capacity);
   }
-}
\ No newline at end of file
+}
+
+static size_t update_recursive(
+  qtree_t *qtree,
+  arena_t *arena,
+  size_t merge_len,
+  qtree_pending_t *pending,
+  qtree_update_stats_t *stats
+) {
+  assert(qtree != NULL);
+  size_t base = pending->len;
+
+  // evict our own elements that moved out of range
+  for (size_t i = 0; i < qtree->data_len;) {
+    if ((qtree->check_range)(qtree->data[i], qtree->range)) {
+      ++i;
+      continue;
+    }
+    pending_push(pending, qtree->data[i]);
+    qtree->data[i] = qtree->data[--qtree->data_len];
+    stats->moved += 1;
+  }
+
+  size_t len = qtree->data_len;
+  if (is_subdivided(qtree)) {
+    len += update_recursive(qtree->ne, arena, merge_len, pending, stats);
+    len += update_recursive(qtree->se, arena, merge_len, pending, stats);
+    len += update_recursive(qtree->sw, arena, merge_len, pending, stats);
+    len += update_recursive(qtree->nw, arena, merge_len, pending, stats);
+  }
+
+  // take back what falls in our range (including from our children), and
+  // pass the rest further up
+  size_t kept = base;
+  for (size_t i = base; i < pending->len; ++i) {
+    void *ele = pending->eles[i];
+    if (qtree_insert(qtree, arena, ele)) {
+      len += 1;
+    } else {
+      pending->eles[kept++] = ele;
+    }
+  }
+  pending->len = kept;
+
+  if (is_subdivided(qtree) && len <= merge_len) {
+    // sparse enough to be a single node again, our children become garbage
+    size_t nodes = 0;
+    gather_recursive(qtree->ne, qtree->data, &qtree->data_len, &nodes);
+    gather_recursive(qtree->se, qtree->data, &qtree->data_len, &nodes);
+    gather_recursive(qtree->sw, qtree->data, &qtree->data_len, &nodes);
+    gather_recursive(qtree->nw, qtree->data, &qtree->data_len, &nodes);
+    assert(qtree->data_len == len);
+    qtree->ne = NULL;
+    qtree->se = NULL;
+    qtree->sw = NULL;
+    qtree->nw = NULL;
+    stats->merged += nodes;
+  }
+
+  return len;
+}
+
+static void gather_recursive(qtree_t *qtree, void **out, size_t *out_len, size_t *nodes) {
+  assert(qtree != NULL);
+  for (size_t i = 0; i < qtree->data_len; ++i) {
+    out[(*out_len)++] = qtree->data[i];
+  }
+  *nodes += 1;
+
+  if (is_subdivided(qtree)) {
+    gather_recursive(qtree->ne, out, out_len, nodes);
+    gather_recursive(qtree->se, out, out_len, nodes);
+    gather_recursive(qtree->sw, out, out_len, nodes);
+    gather_recursive(qtree->nw, out, out_len, nodes);
+  }
+}
+
+static void pending_push(qtree_pending_t *pending, void *ele) {
+  assert(pending != NULL);
+  if (pending->len == pending->capacity) {
+    pending->capacity = pending->capacity == 0 ? 64 : 2*pending->capacity;
+    pending->eles = realloc(pending->eles, pending->capacity*sizeof(void *));
+    assert(pending->eles != NULL);
+  }
+  pending->eles[pending->len++] = ele;
+}
+
+static void radius_recursive(
+  qtree_t *qtree,
+  v2f_t center,
+  float sqr_radius,
+  qtree_point_fn_t point,
+  void **found,
+  size_t *found_count,
+  size_t found_capacity
+) {
+  assert(qtree != NULL);
+
+  if (rect_min_sqr_dist(qtree->range, center) > sqr_radius) {
+    // no part of us reaches into the circle
+    return;
+  }
+
+  // is all of our range within the circle, or should we measure each element?
+  bool add_all = rect_max_sqr_dist(qtree->range, center) <= sqr_radius;
+  for (size_t i = 0; i < qtree->data_len; ++i) {
+    if (add_all || v2f_sqr_len(v2f_sub(point(qtree->data[i]), center)) <= sqr_radius) {
+      if (*found_count < found_capacity) {
+        found[*found_count] = qtree->data[i];
+      }
+      *found_count += 1;
+    }
+  }
+
+  if (is_subdivided(qtree)) {
+    radius_recursive(qtree->ne, center, sqr_radius, point, found, found_count, found_capacity);
+    radius_recursive(qtree->se, center, sqr_radius, point, found, found_count, found_capacity);
+    radius_recursive(qtree->sw, center, sqr_radius, point, found, found_count, found_capacity);
+    radius_recursive(qtree->nw, center, sqr_radius, point, found, found_count, found_capacity);
+  }
+}
+
+static void nearest_recursive(qtree_t *qtree, v2f_t center, qtree_point_fn_t point, nearest_t *nearest) {
+  assert(qtree != NULL);
+
+  for (size_t i = 0; i < qtree->data_len; ++i) {
+    nearest_offer(nearest, qtree->data[i], v2f_sqr_len(v2f_sub(point(qtree->data[i]), center)));
+  }
+
+  if (!is_subdivided(qtree)) {
+    return;
+  }
+
+  // the quadrant holding center first, so the bound tightens as early as it can
+  qtree_t *children[4] = {qtree->ne, qtree->se, qtree->sw, qtree->nw};
+  float sqr_dists[4];
+  for (size_t c = 0; c < 4; ++c) {
+    sqr_dists[c] = rect_min_sqr_dist(children[c]->range, center);
+    for (size_t j = c; j > 0 && sqr_dists[j - 1] > sqr_dists[j]; --j) {
+      float sqr_dist = sqr_dists[j];
+      sqr_dists[j] = sqr_dists[j - 1];
+      sqr_dists[j - 1] = sqr_dist;
+      qtree_t *child = children[j];
+      children[j] = children[j - 1];
+      children[j - 1] = child;
+    }
+  }
+
+  for (size_t c = 0; c < 4; ++c) {
+    if (sqr_dists[c] >= nearest_bound(nearest)) {
+      // neither this quadrant nor any farther one can hold anything nearer
+      return;
+    }
+    nearest_recursive(children[c], center, point, nearest);
+  }
+}
@@ -16,13 +16,10 @@
 #define FPS (60)
 
 #define TITLE ("boids")
-#define WIDTH (1650.0)
-#define HEIGHT (1000.0)
 
 #define BOID_WIDTH (3.0)
 #define BOID_HEIGHT (6.0)
 
-#define BOID_COUNT (10000)
 #define BOID_COLOUR (RED)
 
 /// Draw a singular boid at its given position, facing in the direction of 
@@ -86,18 +83,29 @@ void draw_simulation(simulation_t *sim) {
 }
 
 int main(int argc, char *argv[]) {
-  (void) argc;
-  (void) argv;
+  // every argument is a --name=value simulation setting
+  simulation_config_t config = simulation_config_default();
+  for (int i = 1; i < argc; ++i) {
+    if (!simulation_config_set_arg(&config, argv[i])) {
+      fprintf(stderr, "Usage: %s [--name=value...]\n", argv[0]);
+      simulation_config_usage(stderr);
+      return EXIT_FAILURE;
+    }
+  }
+  if (config.boids_len == 0 || config.width <= 0.0 || config.height <= 0.0) {
+    fprintf(stderr, "%s: boids, width and height must be above 0\n", argv[0]);
+    return EXIT_FAILURE;
+  }
 
   srand(time(NULL));
 
   // create window
-  InitWindow((int) WIDTH, (int) HEIGHT, TITLE);
+  InitWindow((int) config.width, (int) config.height, TITLE);
   SetTargetFPS(FPS);
 
   // create simulation
   simulation_t sim = {0};
-  simulation_init(&sim, WIDTH, HEIGHT, BOID_COUNT);
+  simulation_init(&sim, &config);
 
   // run simulation
   while (!WindowShouldClose()) {
@@ -105,7 +113,7 @@ int main(int argc, char *argv[]) {
     // if user pressed r, reload the simulation
     if (IsKeyPressed(KEY_R)) {
       simulation_free(&sim);
-      simulation_init(&sim, WIDTH, HEIGHT, BOID_COUNT);
+      simulation_init(&sim, &config);
     }
     // advance the simulation
     simulation_tick(&sim, (float) dt);
@@ -29,6 +29,20 @@ bool rect_is_inside(rect_t rect, rect_t other) {
           rect.center.y + rect.half_height <= other.center.y + other.half_height);
 }
 
+float rect_min_sqr_dist(rect_t rect, v2f_t point) {
+  float dx = fabsf(point.x - rect.center.x) - rect.half_width;
+  float dy = fabsf(point.y - rect.center.y) - rect.half_height;
+  if (dx < 0.0f) dx = 0.0f;
+  if (dy < 0.0f) dy = 0.0f;
+  return dx*dx + dy*dy;
+}
+
+float rect_max_sqr_dist(rect_t rect, v2f_t point) {
+  float dx = fabsf(point.x - rect.center.x) + rect.half_width;
+  float dy = fabsf(point.y - rect.center.y) + rect.half_height;
+  return dx*dx + dy*dy;
+}
+
 void rect_quadrants(rect_t rect, rect_t *ne, rect_t *nw, rect_t *sw, rect_t *se) {
   float hw = rect.half_width/2.0;
   float hh = rect.half_height/2.0;
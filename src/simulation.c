@@ -1,12 +1,39 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <unistd.h>
+#include <stdatomic.h>
 
 #include "mvla.h"
 
+#include "grid.h"
 #include "qtree.h"
+#include "fqtree.h"
+#include "tqtree.h"
+#include "morton.h"
+#include "nearest.h"
 #include "simulation.h"
 
-#define THREAD_COUNT (4)
+#define SCRATCH_CAPACITY (256) // initial neighbours per thread
+
+#define DYNAMIC_GRAIN (64)  // boids claimed at once with SIMULATION_SCHEDULE_DYNAMIC
+#define WEIGHTED_SPLIT (8)  // chunks per thread with SIMULATION_SCHEDULE_WEIGHTED
+
+#define BUILD_DEPTH (3)      // quadtree levels split off into their own units of work
+#define BUILD_MIN_LEN (1024) // smaller subtrees are built by a single thread
+#define MERGE_DIV (2) // incremental quadtree subtrees merge below capacity/MERGE_DIV elements
+
+#define VERLET_MOVERS_DIV (32) // rebuild the cached lists once over 1/32 of boids moved
+#define BATCH_SLACK (1.0) // extra reach of a leaf's query, covers rounding in its bounds
+
+#define KERNEL_LANES (8)  // neighbours summed side by side in the SoA kernel
+#define KERNEL_BATCH (64) // neighbours gathered into lanes per pass, multiple of KERNEL_LANES
 
 /// Separation, alignment, and cohesion are all normalized to magnitude=1
 typedef struct boid_update {
@@ -15,29 +42,254 @@ typedef struct boid_update {
   v2f_t cohesion;
 } boid_update_t;
 
+/// Running totals over a neighbourhood, averaged into a boid_update_t later on
+typedef struct boid_sums {
+  v2f_t separation;
+  v2f_t alignment;
+  v2f_t cohesion;
+  size_t count;
+} boid_sums_t;
+
+/// The state of a streamed neighbourhood query: who we are summing for
+typedef struct neighbour_visit {
+  boid_t boid;
+  boid_sums_t sums;
+} neighbour_visit_t;
+
+/// The position a boid is filed under in a boid_qtree_t
+static v2f_t boid_position(const boid_t *boid);
+/// Add a single neighbour to the sums of boid
+static void accumulate_neighbour(boid_sums_t *sums, boid_t boid, const boid_t *other);
+/// Add neighbours a and b to each other's sums, as accumulate_neighbour would
+/// from both sides
+static void accumulate_pair(boid_sums_t *a_sums, const boid_t *a, boid_sums_t *b_sums, const boid_t *b);
+/// The visitor of a streamed boid_qtree_t query, accumulating each neighbour
+static void visit_neighbour(neighbour_visit_t *visit, boid_t *other, v2f_t point);
+
+TQTREE_DECLARE(boid_qtree, boid_t)
+TQTREE_DEFINE(boid_qtree, boid_t, boid_position)
+TQTREE_VISITOR(boid_qtree, boid_qtree_visit_neighbours, neighbour_visit_t, visit_neighbour)
+
 /// A unit of work to perform on another thread; pretty much a request to update
-/// sim->boids_swap[start..end] given the state of qtree
+/// sim->boids_swap[start..end] given the state of the spatial index (qtree or grid)
 typedef struct {
   boid_t *buffer; // READ ONLY
   size_t start;
   size_t end;
+  // when set, [start..end] is instead claimed DYNAMIC_GRAIN boids at a time
+  atomic_size_t *cursor;
+  // when set, [start..end] indexes these leaves of fqtree instead of boids,
+  // and is always claimed from cursor one leaf at a time
+  const fqtree_leaf_t *leaves;
+  // when set, the neighbourhood sums of every boid were already accumulated by
+  // pairs, indexed like the boids
+  const boid_sums_t *pair_sums;
+  // when set, boids are updated from these cached neighbour lists instead of
+  // querying the spatial index
+  simulation_verlet_t *verlet;
+  // when set, boids are updated from this tick's neighbour graph instead
+  const simulation_graph_t *graph;
+  // when set, [start..end] is not updated at all but has its neighbourhoods
+  // (grown by list_skin) queried into this part, their lengths into list_lens
+  simulation_list_part_t *list_part;
+  uint32_t *list_lens;
+  float list_skin;
   boid_t *swap; // WRITE ONLY (only between start..end)
+  uint32_t *costs; // WRITE ONLY (only between start..end)
+  const simulation_config_t *config; // READ ONLY
+  const boid_soa_t *soa; // READ ONLY, columns of buffer (NULL unless SoA layout)
+  boid_soa_t *soa_swap; // WRITE ONLY, columns of swap (only between start..end)
+  simulation_scratch_t *scratch; // indexed by tpool_worker_index
   float dt;
-  qtree_t *qtree;
+  // stable identities of buffer's boids and the tick, which seed config.sample
+  const uint32_t *ids; // READ ONLY
+  size_t tick;
+  qtree_t *qtree; // NULL unless SIMULATION_INDEX_QTREE
+  grid_t *grid; // NULL unless SIMULATION_INDEX_GRID
+  fqtree_t *fqtree; // NULL unless SIMULATION_INDEX_FLAT
+  boid_qtree_t *typed; // NULL unless SIMULATION_INDEX_TYPED
 } boid_chunk_task_t;
 
+/// A unit of work to perform on another thread; build the subtree rooted at the
+/// (empty) qtree from eles, splitting its children off as more units of work
+/// while the subtree is shallow and large enough to be worth it
+typedef struct qtree_build_task {
+  tpool_t *pool;
+  simulation_scratch_t *scratch; // indexed by tpool_worker_index, for arenas
+  qtree_t *qtree;
+  void **eles; // READ ONLY
+  void **spare; // WRITE ONLY, as long as eles
+  size_t len;
+  size_t depth;
+  bool persist; // allocate from the scratch tree arenas, which outlive the tick
+} qtree_build_task_t;
+
+/// A unit of work to perform on another thread; accumulate every pair of
+/// neighbours with a boid in a grid row of the given parity into sums,
+/// claiming rows from cursor until there are none left
+typedef struct boid_pair_task {
+  const grid_t *grid; // READ ONLY
+  const boid_t *buffer; // READ ONLY
+  atomic_size_t *cursor;
+  size_t parity;
+  // shared by every thread, a row only writes to the boids in it and the row
+  // below, so rows of the same parity never write to the same boid
+  boid_sums_t *sums;
+} boid_pair_task_t;
+
+/// qtree_build_task_t for a boid_qtree_t
+typedef struct boid_qtree_build_task {
+  tpool_t *pool;
+  simulation_scratch_t *scratch; // indexed by tpool_worker_index, for arenas
+  boid_qtree_t *qtree;
+  boid_t **eles; // READ ONLY
+  boid_t **spare; // WRITE ONLY, as long as eles
+  size_t len;
+  size_t depth;
+} boid_qtree_build_task_t;
+
 /// Update all boids in the simulation, storing in swap buffer
 static void update_boids(simulation_t *sim, float dt);
+/// Divide the update into units of work as per config.schedule and submit them,
+/// each a copy of shared with its own range
+static void submit_updates(simulation_t *sim, const boid_chunk_task_t *shared);
+/// Sum every boid's neighbourhood by visiting each pair of neighbours in grid
+/// once, all even rows of cells at once and then all odd ones
+static boid_sums_t *accumulate_pairs(simulation_t *sim, const grid_t *grid);
+/// Accumulate the pairs with a boid in row of the grid (and the other in the
+/// same or a later cell)
+static void accumulate_row(const boid_pair_task_t *task, size_t row);
+/// Build a quadtree over boids in parallel on the threadpool, identical to
+/// inserting every boid in order on one thread; a persistent tree is allocated
+/// from the tree arenas instead of the per-tick ones
+static qtree_t *build_qtree(simulation_t *sim, rect_t range, boid_t *boids, bool persist);
+/// build_qtree for a boid_qtree_t, identical in shape to what build_qtree makes
+static boid_qtree_t *build_boid_qtree(simulation_t *sim, rect_t range);
+/// Bring the persistent quadtree up to date with boids (through sim->tracked),
+/// rebuilding it from scratch when there is none or it has collected too much garbage
+static qtree_t *track_qtree(simulation_t *sim, rect_t range);
+/// Whether config.skin is in effect under the rest of the config
+static bool verlet_enabled(const simulation_config_t *config);
+/// Turn boids that moved more than half the skin into movers, returning whether
+/// the cached neighbour lists (and movers) still cover every neighbourhood
+static bool verlet_track(simulation_t *sim);
+/// Bin the movers by their current position, for this tick's queries
+static void bin_movers(simulation_t *sim, rect_t range);
+/// Build the cached neighbour lists from the spatial index shared knows about,
+/// in one part per thread
+static void build_verlet(simulation_t *sim, const boid_chunk_task_t *shared);
+/// Whether config.graph is in effect under the rest of the config
+static bool graph_enabled(const simulation_config_t *config);
+/// Record this tick's neighbour graph from the spatial index shared knows about
+static void build_graph(simulation_t *sim, const boid_chunk_task_t *shared);
+/// Query the neighbourhoods of all boids grown by skin into lists, boids
+/// len*p/parts_len onwards going into parts[p], with their lengths in lens
+static void query_lists(
+  simulation_t *sim,
+  const boid_chunk_task_t *shared,
+  simulation_list_part_t *parts,
+  size_t parts_len,
+  uint32_t *lens,
+  float skin
+);
+/// Sort boids (and everything indexed like them) by the Morton code of their position
+static void reorder_boids(simulation_t *sim);
 /// Keep boids on screen, currently just reverse velocity
 static void constrain_boids(simulation_t *sim);
 /// Swap buffers, old content is now ready to be written over
 static void swap_buffers(simulation_t *sim);
-/// Place the src boid into dest, and adjust given other boids and their count
-static void update_boid_into_swap(boid_t *dest, const boid_t src, qtree_t *qtree, float delta_time);
-/// Determine directional deltas for a boid
-static boid_update_t calculate_deltas(boid_t boid, qtree_t *qtree);
-/// Calculate the acceleration of a boid with the given deltas
-static v2f_t calculate_acceleration(boid_update_t deltas);
+/// Update boids start..end of a unit of work into its swap buffer
+static void update_range(const boid_chunk_task_t *task, size_t start, size_t end);
+/// Query the neighbour lists of boids start..end of a unit of work into its part
+static void build_lists(const boid_chunk_task_t *task);
+/// Update boids start..end of a unit of work from the neighbour graph
+static void update_from_graph(const boid_chunk_task_t *task, size_t start, size_t end);
+/// Update boids start..end of a unit of work from the cached neighbour lists
+static void update_from_lists(const boid_chunk_task_t *task, size_t start, size_t end);
+/// Append the elements of grid in range to the scratch neighbours (after the
+/// first len), growing scratch as needed, and return how many there are now
+static size_t append_grid_query(simulation_scratch_t *scratch, size_t len, grid_t *grid, rect_t range);
+/// Update every boid in one leaf of fqtree from a single query around the leaf
+static void update_leaf(const boid_chunk_task_t *task, fqtree_leaf_t leaf);
+/// Copy the neighbours found for a leaf into the scratch candidates, along with
+/// their positions
+static void load_candidates(simulation_scratch_t *scratch, size_t candidates_len);
+/// Write the candidates within the neighbourhood of boid (the circle of radius
+/// if above 0, else its box) into the scratch neighbours, returning how many
+static size_t filter_candidates(simulation_scratch_t *scratch, size_t candidates_len, boid_t boid, float radius);
+/// Place the src boid (buffer[index]) into dest, and adjust given other boids
+/// and their count, returning how many neighbours were considered
+static size_t update_boid_into_swap(boid_t *dest, const boid_t src, size_t index, const boid_chunk_task_t *task);
+/// Place the src boid into dest, moved as per its deltas
+static void move_boid(boid_t *dest, const boid_t src, boid_update_t update, const boid_chunk_task_t *task);
+/// Determine directional deltas for a boid (buffer[index]), along with its
+/// neighbour count
+static boid_update_t calculate_deltas(boid_t boid, size_t index, const boid_chunk_task_t *task, size_t *out_count);
+/// Query the spatial index for neighbours in range, growing scratch on overflow;
+/// with an aggregate (only for a summed fqtree) subtrees out of separation range
+/// of origin, or far subtrees too when far is set, are folded into it instead
+static size_t query_neighbours(
+  const boid_chunk_task_t *task,
+  rect_t range,
+  v2f_t origin,
+  simulation_scratch_t *scratch,
+  fqtree_aggregate_t *aggregate,
+  bool far
+);
+/// Query the spatial index for neighbours within radius of origin, pruning by
+/// distance in the quadtree and filtering a box query for the other indexes
+static size_t query_radius(
+  const boid_chunk_task_t *task,
+  v2f_t origin,
+  float radius,
+  simulation_scratch_t *scratch
+);
+/// Query the spatial index for the config.knn boids nearest to origin besides
+/// the one at origin itself (which comes first), pruning by distance in the
+/// quadtrees and widening box queries until they are known to hold them otherwise
+static size_t query_nearest(const boid_chunk_task_t *task, v2f_t origin, simulation_scratch_t *scratch);
+/// Sum the rules over the neighbours found for boid (buffer[index]), with
+/// whichever kernel the layout wants, over a re-weighted subsample of them if
+/// there are more than config.sample
+static boid_sums_t sum_found(
+  boid_t boid,
+  size_t index,
+  const boid_chunk_task_t *task,
+  boid_t **neighbours,
+  size_t neighbours_len
+);
+/// Keep the neighbours whose sample_key falls in the lowest sample_len out of
+/// neighbours_len of its range (about sample_len of them, and at least the one
+/// with the lowest key) at the front of neighbours, returning how many; which
+/// ones depends on their ids only, never on the order the index listed them in
+static size_t sample_neighbours(
+  const boid_chunk_task_t *task,
+  uint32_t seed,
+  boid_t **neighbours,
+  size_t neighbours_len,
+  size_t sample_len
+);
+/// The hash deciding whether other makes the subsample seeded by seed, from its
+/// stable id
+static uint32_t sample_key(const boid_chunk_task_t *task, uint32_t seed, const boid_t *other);
+/// Scale sums over a subsample up to what they'd be over neighbours_len boids
+static boid_sums_t reweight_sums(boid_sums_t sums, size_t neighbours_len);
+/// Mix the bits of x (lowbias32), for picking subsamples
+static uint32_t sample_hash(uint32_t x);
+/// Sum the rules over neighbours one boid_t at a time
+static boid_sums_t sum_neighbours(boid_t boid, boid_t **neighbours, size_t neighbours_len);
+/// Sum the rules over neighbours KERNEL_LANES at a time, reading from columns
+static boid_sums_t sum_neighbours_soa(
+  boid_t boid,
+  const boid_soa_t *soa,
+  const boid_t *buffer,
+  boid_t **neighbours,
+  size_t neighbours_len
+);
+/// Turn neighbourhood sums into steering deltas
+static boid_update_t finish_deltas(boid_t boid, boid_sums_t sums);
+/// Calculate the acceleration of a boid with the given deltas, scaled by config
+static v2f_t calculate_acceleration(boid_update_t deltas, const simulation_config_t *config);
 /// Cap a's magnitude to mag if mag > 0, otherwise do nothing
 static v2f_t limit_magnitude(v2f_t a, float mag);
 /// Steer a boid in a desired direction
@@ -46,42 +298,300 @@ static v2f_t steer(v2f_t current_velocity, v2f_t desired);
 static v2f_t safe_v2f_div(v2f_t a, v2f_t b);
 /// The qtree_range_fn_t used in a boid quadtree
 static bool boid_in_range(void *ele, rect_t range);
+/// The grid_point_fn_t (and fqtree_point_fn_t) used in a boid grid
+static v2f_t boid_point(void *ele);
+/// The grid_point_fn_t used for a grid over pointers to boids
+static v2f_t boid_ref_point(void *ele);
+/// The grid_point_fn_t used for a grid over positions
+static v2f_t origin_point(void *ele);
+/// The fqtree_value_fn_t used to sum boid velocities into fqtree nodes
+static v2f_t boid_velocity(void *ele);
 /// The thread_func_t work we want to do to update a range of boids into boids_swap
 static void chunk_boid_update(void *arg);
+/// The thread_func_t work we want to do to accumulate rows of neighbour pairs
+static void chunk_pair_accumulate(void *arg);
+/// The thread_func_t work we want to do to build (part of) a quadtree
+static void chunk_qtree_build(void *arg);
+/// The thread_func_t work we want to do to build (part of) a boid_qtree_t
+static void chunk_boid_qtree_build(void *arg);
+/// Parse a 0/1 setting, returning success
+static bool parse_bool(const char *value, bool *out);
+
+simulation_config_t simulation_config_default(void) {
+  simulation_config_t config;
+  config.width = 1650.0;
+  config.height = 1000.0;
+  config.boids_len = 10000;
+  config.thread_count = 0;
+  config.pool_mode = TPOOL_MODE_SHARED;
+  config.qtree_capacity = 85;
+  config.separation_scale = 2.0;
+  config.alignment_scale = 2.0;
+  config.cohesion_scale = 3.0;
+  config.layout = SIMULATION_LAYOUT_AOS;
+  config.index = SIMULATION_INDEX_QTREE;
+  config.schedule = SIMULATION_SCHEDULE_STATIC;
+  config.reorder_interval = 0;
+  config.incremental = false;
+  config.aggregate = false;
+  config.far_radius = 0.0;
+  config.far_theta = 0.5;
+  config.hood_radius = 0.0;
+  config.stream = false;
+  config.bulk = false;
+  config.batch = false;
+  config.pairs = false;
+  config.skin = 0.0;
+  config.graph = false;
+  config.knn = 0;
+  config.sample = 0;
+  return config;
+}
+
+bool simulation_config_set(simulation_config_t *config, const char *name, const char *value) {
+  assert(config != NULL);
+  if (name == NULL || value == NULL) return false;
+
+  if (strcmp(name, "boids") == 0) return simulation_parse_size(value, &config->boids_len);
+  if (strcmp(name, "width") == 0) return simulation_parse_float(value, &config->width);
+  if (strcmp(name, "height") == 0) return simulation_parse_float(value, &config->height);
+  if (strcmp(name, "threads") == 0) return simulation_parse_size(value, &config->thread_count);
+  if (strcmp(name, "capacity") == 0) {
+    size_t capacity = 0;
+    if (!simulation_parse_size(value, &capacity) || capacity == 0) return false;
+    config->qtree_capacity = capacity;
+    return true;
+  }
+  if (strcmp(name, "separation") == 0) return simulation_parse_float(value, &config->separation_scale);
+  if (strcmp(name, "alignment") == 0) return simulation_parse_float(value, &config->alignment_scale);
+  if (strcmp(name, "cohesion") == 0) return simulation_parse_float(value, &config->cohesion_scale);
+  if (strcmp(name, "reorder") == 0) return simulation_parse_size(value, &config->reorder_interval);
+  if (strcmp(name, "incremental") == 0) return parse_bool(value, &config->incremental);
+  if (strcmp(name, "aggregate") == 0) return parse_bool(value, &config->aggregate);
+  if (strcmp(name, "far") == 0) return simulation_parse_float(value, &config->far_radius);
+  if (strcmp(name, "theta") == 0) return simulation_parse_float(value, &config->far_theta);
+  if (strcmp(name, "radius") == 0) return simulation_parse_float(value, &config->hood_radius);
+  if (strcmp(name, "stream") == 0) return parse_bool(value, &config->stream);
+  if (strcmp(name, "bulk") == 0) return parse_bool(value, &config->bulk);
+  if (strcmp(name, "batch") == 0) return parse_bool(value, &config->batch);
+  if (strcmp(name, "pairs") == 0) return parse_bool(value, &config->pairs);
+  if (strcmp(name, "skin") == 0) return simulation_parse_float(value, &config->skin);
+  if (strcmp(name, "graph") == 0) return parse_bool(value, &config->graph);
+  if (strcmp(name, "knn") == 0) {
+    size_t knn = 0;
+    if (!simulation_parse_size(value, &knn) || knn > KNN_MAX) return false;
+    config->knn = knn;
+    return true;
+  }
+  if (strcmp(name, "sample") == 0) return simulation_parse_size(value, &config->sample);
+
+  if (strcmp(name, "pool") == 0) {
+    if (strcmp(value, "shared") == 0) config->pool_mode = TPOOL_MODE_SHARED;
+    else if (strcmp(value, "stealing") == 0) config->pool_mode = TPOOL_MODE_STEALING;
+    else return false;
+    return true;
+  }
+  if (strcmp(name, "layout") == 0) {
+    if (strcmp(value, "aos") == 0) config->layout = SIMULATION_LAYOUT_AOS;
+    else if (strcmp(value, "soa") == 0) config->layout = SIMULATION_LAYOUT_SOA;
+    else return false;
+    return true;
+  }
+  if (strcmp(name, "index") == 0) {
+    if (strcmp(value, "qtree") == 0) config->index = SIMULATION_INDEX_QTREE;
+    else if (strcmp(value, "grid") == 0) config->index = SIMULATION_INDEX_GRID;
+    else if (strcmp(value, "flat") == 0) config->index = SIMULATION_INDEX_FLAT;
+    else if (strcmp(value, "typed") == 0) config->index = SIMULATION_INDEX_TYPED;
+    else return false;
+    return true;
+  }
+  if (strcmp(name, "schedule") == 0) {
+    if (strcmp(value, "static") == 0) config->schedule = SIMULATION_SCHEDULE_STATIC;
+    else if (strcmp(value, "dynamic") == 0) config->schedule = SIMULATION_SCHEDULE_DYNAMIC;
+    else if (strcmp(value, "weighted") == 0) config->schedule = SIMULATION_SCHEDULE_WEIGHTED;
+    else return false;
+    return true;
+  }
+
+  return false;
+}
+
+bool simulation_config_set_arg(simulation_config_t *config, const char *arg) {
+  assert(config != NULL);
+  if (arg == NULL || strncmp(arg, "--", 2) != 0) return false;
+  arg += 2;
+
+  const char *equals = strchr(arg, '=');
+  if (equals == NULL) return false;
+
+  char name[32] = {0};
+  size_t name_len = (size_t) (equals - arg);
+  if (name_len == 0 || name_len >= sizeof(name)) return false;
+  memcpy(name, arg, name_len);
 
-void simulation_init(simulation_t *sim, float width, float height, size_t boids_len) {
+  return simulation_config_set(config, name, equals + 1);
+}
+
+void simulation_config_usage(FILE *out) {
+  simulation_config_t d = simulation_config_default();
+  fprintf(out, "  --boids=<n>          number of boids (default %zu)\n", d.boids_len);
+  fprintf(out, "  --width=<w>          simulation width (default %.0f)\n", d.width);
+  fprintf(out, "  --height=<h>         simulation height (default %.0f)\n", d.height);
+  fprintf(out, "  --threads=<n>        pool threads, 0 for one per CPU (default 0)\n");
+  fprintf(out, "  --pool=<mode>        shared | stealing (default shared)\n");
+  fprintf(out, "  --capacity=<n>       quadtree node/leaf capacity (default %zu)\n", d.qtree_capacity);
+  fprintf(out, "  --separation=<s>     separation scale (default %.1f)\n", d.separation_scale);
+  fprintf(out, "  --alignment=<s>      alignment scale (default %.1f)\n", d.alignment_scale);
+  fprintf(out, "  --cohesion=<s>       cohesion scale (default %.1f)\n", d.cohesion_scale);
+  fprintf(out, "  --layout=<layout>    aos | soa (default aos)\n");
+  fprintf(out, "  --index=<index>      qtree | grid | flat | typed (default qtree)\n");
+  fprintf(out, "  --schedule=<sched>   static | dynamic | weighted (default static)\n");
+  fprintf(out, "  --reorder=<ticks>    Z-order reorder interval, 0 for never (default 0)\n");
+  fprintf(out, "  --incremental=<0|1>  keep the quadtree between ticks (default 0)\n");
+  fprintf(out, "  --aggregate=<0|1>    sum far flat quadtree nodes in bulk (default 0)\n");
+  fprintf(out, "  --far=<half-width>   alignment/cohesion perception box half-width, 0 for off (default 0)\n");
+  fprintf(out, "  --theta=<angle>      Barnes-Hut opening angle for --far (default %.1f)\n", d.far_theta);
+  fprintf(out, "  --radius=<r>         circular neighbourhood (e.g. %.0f), 0 for the %.0fx%.0f box (default 0)\n",
+    HOOD_RADIUS, NEIGHBOURHOOD_WIDTH, NEIGHBOURHOOD_HEIGHT);
+  fprintf(out, "  --stream=<0|1>       sum while walking the typed quadtree (default 0)\n");
+  fprintf(out, "  --bulk=<0|1>         bulk load the flat quadtree from Morton codes (default 0)\n");
+  fprintf(out, "  --batch=<0|1>        query once per flat quadtree leaf (default 0)\n");
+  fprintf(out, "  --pairs=<0|1>        sum each pair of neighbours once on the grid (default 0)\n");
+  fprintf(out, "  --skin=<d>           reuse neighbour lists grown by d until a boid moves d/2, 0 for off (default 0)\n");
+  fprintf(out, "  --graph=<0|1>        record each tick's neighbour graph (default 0)\n");
+  fprintf(out, "  --knn=<k>            interact with the k nearest boids (e.g. 7, at most %d), 0 for off (default 0)\n", KNN_MAX);
+  fprintf(out, "  --sample=<n>         sum a re-weighted subsample of about n from larger neighbourhoods, 0 for off (default 0)\n");
+}
+
+void simulation_init(simulation_t *sim, const simulation_config_t *config) {
   assert(sim != NULL);
+  assert(config != NULL);
+  assert(config->qtree_capacity > 0);
   sim->ticks = 0;
+  sim->config = *config;
   
   arena_init(&sim->arena);
 
-  sim->pool = tpool_new(THREAD_COUNT);
+  sim->thread_count = config->thread_count;
+  if (sim->thread_count == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    sim->thread_count = cpus > 0 ? (size_t) cpus : 1;
+  }
+
+  sim->pool = tpool_new_mode(sim->thread_count, config->pool_mode);
+  sim->scratch_len = sim->thread_count;
+  sim->scratch = calloc(sim->scratch_len, sizeof(simulation_scratch_t));
+  assert(sim->scratch != NULL);
+  for (size_t i = 0; i < sim->scratch_len; ++i) {
+    sim->scratch[i].capacity = SCRATCH_CAPACITY;
+    sim->scratch[i].neighbours = calloc(SCRATCH_CAPACITY, sizeof(boid_t *));
+    assert(sim->scratch[i].neighbours != NULL);
+    arena_init(&sim->scratch[i].arena);
+    arena_init(&sim->scratch[i].tree_arena);
+  }
 
+  float width = config->width, height = config->height;
+  size_t boids_len = config->boids_len;
   sim->width = width;
   sim->height = height;
 
   sim->boids_len = boids_len;
   sim->boids = calloc(boids_len, sizeof(boid_t));
   sim->boids_swap = calloc(boids_len, sizeof(boid_t));
+  sim->ids = calloc(boids_len, sizeof(uint32_t));
+
+  sim->soa = (boid_soa_t) {0};
+  sim->soa_swap = (boid_soa_t) {0};
+  if (config->layout == SIMULATION_LAYOUT_SOA) {
+    boid_soa_init(&sim->soa, boids_len);
+    boid_soa_init(&sim->soa_swap, boids_len);
+  }
+
+  sim->costs = calloc(boids_len, sizeof(uint32_t));
+
+  sim->qtree = NULL;
+  sim->tracked = calloc(boids_len, sizeof(boid_t));
+  arena_init(&sim->tree_arena);
+  sim->tree_garbage = 0;
+  sim->tree_pending = (qtree_pending_t) {0};
+
+  sim->verlet.valid = false;
+  sim->verlet.origins = calloc(boids_len, sizeof(v2f_t));
+  arena_init(&sim->verlet.arena);
+  sim->verlet.lists = calloc(boids_len, sizeof(uint32_t *));
+  sim->verlet.lens = calloc(boids_len, sizeof(uint32_t));
+  sim->verlet.parts_len = sim->thread_count;
+  sim->verlet.parts = calloc(sim->verlet.parts_len, sizeof(simulation_list_part_t));
+  sim->verlet.moved = calloc(boids_len, sizeof(bool));
+  sim->verlet.movers_len = 0;
+  sim->verlet.movers = calloc(boids_len, sizeof(uint32_t));
+  assert(sim->verlet.origins != NULL && sim->verlet.lists != NULL);
+  assert(sim->verlet.lens != NULL && sim->verlet.parts != NULL);
+  assert(sim->verlet.moved != NULL && sim->verlet.movers != NULL);
+
+  sim->graph.len = 0;
+  arena_init(&sim->graph_arena);
+  sim->graph_parts_len = sim->thread_count;
+  sim->graph_parts = calloc(sim->graph_parts_len, sizeof(simulation_list_part_t));
+  assert(sim->graph_parts != NULL);
 
   for (size_t i = 0; i < boids_len; ++i) {
+    sim->ids[i] = (uint32_t) i;
     sim->boids[i].position.x = width*randf();
     sim->boids[i].position.y = height*randf();
     sim->boids[i].velocity.x = MAX_SPEED*randf();
     sim->boids[i].velocity.y = MAX_SPEED*randf();
   }
+  if (sim->config.layout == SIMULATION_LAYOUT_SOA) {
+    boid_soa_load(&sim->soa, sim->boids, boids_len);
+  }
 }
 
 void simulation_free(simulation_t *sim) {
   assert(sim != NULL);
   free(sim->boids);
   free(sim->boids_swap);
+  free(sim->ids);
+  boid_soa_free(&sim->soa);
+  boid_soa_free(&sim->soa_swap);
+  free(sim->costs);
+  free(sim->tracked);
+  qtree_pending_free(&sim->tree_pending);
+  free(sim->verlet.origins);
+  arena_free(&sim->verlet.arena);
+  free(sim->verlet.lists);
+  free(sim->verlet.lens);
+  for (size_t i = 0; i < sim->verlet.parts_len; ++i) {
+    free(sim->verlet.parts[i].indices);
+  }
+  free(sim->verlet.parts);
+  free(sim->verlet.moved);
+  free(sim->verlet.movers);
+  arena_free(&sim->graph_arena);
+  for (size_t i = 0; i < sim->graph_parts_len; ++i) {
+    free(sim->graph_parts[i].indices);
+  }
+  free(sim->graph_parts);
   arena_free(&sim->arena);
+  arena_free(&sim->tree_arena);
   tpool_free(sim->pool);
+  for (size_t i = 0; i < sim->scratch_len; ++i) {
+    free(sim->scratch[i].neighbours);
+    free(sim->scratch[i].candidates);
+    free(sim->scratch[i].candidates_x);
+    free(sim->scratch[i].candidates_y);
+    arena_free(&sim->scratch[i].arena);
+    arena_free(&sim->scratch[i].tree_arena);
+  }
+  free(sim->scratch);
 }
 
 void simulation_tick(simulation_t *sim, float dt) {
   assert(sim != NULL);
+  size_t reorder_interval = sim->config.reorder_interval;
+  if (reorder_interval > 0 && sim->ticks % reorder_interval == 0) {
+    reorder_boids(sim);
+  }
   update_boids(sim, dt);
   constrain_boids(sim);
   sim->ticks += 1;
@@ -89,22 +599,179 @@ void simulation_tick(simulation_t *sim, float dt) {
 
 static void update_boids(simulation_t *sim, float dt) {
   assert(sim != NULL);
-  // initialize our quadtree
   float hw = sim->width/2.0, hh = sim->height/2.0;
   rect_t sim_range = rect_new(v2f(hw, hh), hw, hh);
-  qtree_t *qtree = qtree_new(&sim->arena, 85, sim_range, boid_in_range);
-  
-  for (size_t i = 0; i < sim->boids_len; ++i) {
-    qtree_insert(qtree, &sim->arena, (void *) &sim->boids[i]);
+
+  // initialize our spatial index (and the buffer it points into)
+  boid_t *buffer = sim->boids;
+  qtree_t *qtree = NULL;
+  grid_t grid = {0}, *grid_ptr = NULL;
+  fqtree_t fqtree = {0}, *fqtree_ptr = NULL;
+  fqtree_leaf_t *leaves = NULL;
+  size_t leaves_len = 0;
+  boid_qtree_t *typed = NULL;
+  const boid_sums_t *pair_sums = NULL;
+  bool verlet = verlet_enabled(&sim->config);
+  bool reuse = verlet && verlet_track(sim);
+  if (reuse) {
+    // the cached lists answer every query, so there is no index to build
+  } else if (sim->config.index == SIMULATION_INDEX_GRID) {
+    // a neighbourhood spans at most 2x2 cells of this size
+    grid_init(&grid, sim_range, NEIGHBOURHOOD_WIDTH, NEIGHBOURHOOD_HEIGHT);
+    grid_build(&grid, &sim->arena, sim->boids, sim->boids_len, sizeof(boid_t), boid_point);
+    grid_ptr = &grid;
+    // neighbours are then never more than one cell apart
+    if (sim->config.pairs && sim->config.hood_radius <= 0.0 && sim->config.knn == 0) {
+      pair_sums = accumulate_pairs(sim, &grid);
+    }
+  } else if (sim->config.index == SIMULATION_INDEX_FLAT) {
+    fqtree_init(&fqtree, sim_range, sim->config.qtree_capacity);
+    bool summed = sim->config.aggregate || sim->config.far_radius > 0.0;
+    fqtree_value_fn_t value = summed ? boid_velocity : NULL;
+    if (sim->config.bulk) {
+      fqtree_build_morton(
+        &fqtree, &sim->arena, sim->pool, sim->thread_count,
+        sim->boids, sim->boids_len, sizeof(boid_t), boid_point, value
+      );
+    } else {
+      fqtree_build(&fqtree, &sim->arena, sim->boids, sim->boids_len, sizeof(boid_t), boid_point, value);
+    }
+    fqtree_ptr = &fqtree;
+    // leaves only cover boids in range, the rest need their own queries
+    if (sim->config.batch && !summed && sim->config.knn == 0 && fqtree.items_len == sim->boids_len) {
+      leaves_len = fqtree_leaves(&fqtree, &sim->arena, &leaves);
+    }
+  } else if (sim->config.index == SIMULATION_INDEX_TYPED) {
+    typed = build_boid_qtree(sim, sim_range);
+  } else if (sim->config.incremental) {
+    qtree = track_qtree(sim, sim_range);
+    buffer = sim->tracked;
+  } else {
+    qtree = build_qtree(sim, sim_range, sim->boids, false);
+  }
+
+  // everything units of work have in common
+  boid_chunk_task_t shared = {0};
+  shared.buffer = buffer;
+  shared.swap = sim->boids_swap;
+  shared.costs = sim->costs;
+  shared.config = &sim->config;
+  if (sim->config.layout == SIMULATION_LAYOUT_SOA) {
+    shared.soa = &sim->soa;
+    shared.soa_swap = &sim->soa_swap;
+  }
+  shared.scratch = sim->scratch;
+  shared.dt = dt;
+  shared.ids = sim->ids;
+  shared.tick = sim->ticks;
+  shared.qtree = qtree;
+  shared.grid = grid_ptr;
+  shared.fqtree = fqtree_ptr;
+  shared.typed = typed;
+  shared.pair_sums = pair_sums;
+  if (verlet) {
+    if (!reuse) {
+      build_verlet(sim, &shared);
+    }
+    bin_movers(sim, sim_range);
+    shared.verlet = &sim->verlet;
+  } else if (graph_enabled(&sim->config)) {
+    build_graph(sim, &shared);
+    shared.graph = &sim->graph;
+  }
+  if (shared.graph == NULL) {
+    sim->graph.len = 0;
+  }
+  if (leaves != NULL) {
+    // one unit of work per thread, claiming leaves until none are left
+    atomic_size_t *cursor = arena_alloc(&sim->arena, sizeof(atomic_size_t));
+    boid_chunk_task_t *tasks = arena_alloc(&sim->arena, sim->thread_count*sizeof(boid_chunk_task_t));
+    assert(cursor != NULL && tasks != NULL);
+    atomic_init(cursor, 0);
+    for (size_t i = 0; i < sim->thread_count; ++i) {
+      tasks[i] = shared;
+      tasks[i].start = 0;
+      tasks[i].end = leaves_len;
+      tasks[i].cursor = cursor;
+      tasks[i].leaves = leaves;
+      tpool_add_work(sim->pool, chunk_boid_update, &tasks[i]);
+    }
+  } else {
+    submit_updates(sim, &shared);
+  }
+
+  // finish updating
+  tpool_wait(sim->pool);
+  // reset arenas/free spatial index
+  arena_clear(&sim->arena);
+  for (size_t i = 0; i < sim->scratch_len; ++i) {
+    arena_clear(&sim->scratch[i].arena);
+  }
+  // swap buffers
+  swap_buffers(sim);
+}
+
+static void submit_updates(simulation_t *sim, const boid_chunk_task_t *shared) {
+  assert(sim != NULL);
+  size_t len = sim->boids_len;
+  size_t threads = sim->thread_count;
+
+  if (sim->config.schedule == SIMULATION_SCHEDULE_DYNAMIC) {
+    // one unit of work per thread, all pulling from the same cursor until done
+    atomic_size_t *cursor = arena_alloc(&sim->arena, sizeof(atomic_size_t));
+    boid_chunk_task_t *tasks = arena_alloc(&sim->arena, threads*sizeof(boid_chunk_task_t));
+    assert(cursor != NULL && tasks != NULL);
+    atomic_init(cursor, 0);
+    for (size_t i = 0; i < threads; ++i) {
+      tasks[i] = *shared;
+      tasks[i].start = 0;
+      tasks[i].end = len;
+      tasks[i].cursor = cursor;
+      tpool_add_work(sim->pool, chunk_boid_update, &tasks[i]);
+    }
+    return;
+  }
+
+  if (sim->config.schedule == SIMULATION_SCHEDULE_WEIGHTED) {
+    // cut into chunks of (roughly) equal total cost, where a boid costs one
+    // plus however many neighbours it had to look at last tick
+    size_t parts = threads*WEIGHTED_SPLIT;
+    boid_chunk_task_t *tasks = arena_alloc(&sim->arena, parts*sizeof(boid_chunk_task_t));
+    assert(tasks != NULL);
+    uint64_t total = len;
+    for (size_t i = 0; i < len; ++i) {
+      total += sim->costs[i];
+    }
+
+    size_t start = 0;
+    uint64_t cost = 0;
+    for (size_t part = 0; part < parts && start < len; ++part) {
+      // grow the chunk until the running cost reaches this part's share (the
+      // last share is the total, so the last part takes whatever is left)
+      uint64_t target = (total*(part + 1))/parts;
+      size_t end = start;
+      while (end < len && (cost < target || end == start)) {
+        cost += 1 + sim->costs[end++];
+      }
+
+      tasks[part] = *shared;
+      tasks[part].start = start;
+      tasks[part].end = end;
+      tpool_add_work(sim->pool, chunk_boid_update, &tasks[part]);
+
+      start = end;
+    }
+    return;
   }
 
   // chunk up population and pick up slack
-  size_t chunk_size = sim->boids_len / THREAD_COUNT;
-  size_t slack = sim->boids_len % THREAD_COUNT;
-  boid_chunk_task_t tasks[THREAD_COUNT] = {0};
+  size_t chunk_size = len / threads;
+  size_t slack = len % threads;
+  boid_chunk_task_t *tasks = arena_alloc(&sim->arena, threads*sizeof(boid_chunk_task_t));
+  assert(tasks != NULL);
 
   size_t curr = 0;
-  for (size_t i = 0; i < THREAD_COUNT; ++i) {
+  for (size_t i = 0; i < threads; ++i) {
     size_t start = curr;
     size_t end = start + chunk_size;
     if (i < slack) {
@@ -112,29 +779,327 @@ static void update_boids(simulation_t *sim, float dt) {
       end += 1;
     }
 
-    tasks[i].buffer = sim->boids;
-    tasks[i].swap = sim->boids_swap;
+    tasks[i] = *shared;
     tasks[i].start = start;
     tasks[i].end = end;
-    tasks[i].dt = dt;
-    tasks[i].qtree = qtree;
 
     // add unit of work to threadpool
     tpool_add_work(sim->pool, chunk_boid_update, &tasks[i]);
 
     curr = end;
   }
+}
 
-  // finish updating
+static boid_sums_t *accumulate_pairs(simulation_t *sim, const grid_t *grid) {
+  assert(sim != NULL);
+  assert(grid != NULL);
+  size_t len = sim->boids_len;
+  size_t threads = sim->thread_count;
+
+  boid_sums_t *sums = arena_alloc(&sim->arena, len*sizeof(boid_sums_t));
+  atomic_size_t *cursor = arena_alloc(&sim->arena, sizeof(atomic_size_t));
+  boid_pair_task_t *tasks = arena_alloc(&sim->arena, threads*sizeof(boid_pair_task_t));
+  assert(sums != NULL && cursor != NULL && tasks != NULL);
+  memset(sums, 0, len*sizeof(boid_sums_t));
+
+  // a row writes to itself and the row below, so while only rows of one parity
+  // run no two threads ever write to the same boid
+  for (size_t parity = 0; parity < 2; ++parity) {
+    atomic_init(cursor, 0);
+    for (size_t i = 0; i < threads; ++i) {
+      tasks[i].grid = grid;
+      tasks[i].buffer = sim->boids;
+      tasks[i].cursor = cursor;
+      tasks[i].parity = parity;
+      tasks[i].sums = sums;
+      tpool_add_work(sim->pool, chunk_pair_accumulate, &tasks[i]);
+    }
+    tpool_wait(sim->pool);
+  }
+
+  return sums;
+}
+
+static qtree_t *build_qtree(simulation_t *sim, rect_t range, boid_t *boids, bool persist) {
+  assert(sim != NULL);
+  assert(boids != NULL);
+  arena_t *arena = persist ? &sim->tree_arena : &sim->arena;
+  qtree_t *qtree = qtree_new(arena, sim->config.qtree_capacity, range, boid_in_range);
+  qtree_count_inserts(qtree, &sim->qtree_stats);
+
+  // elements are split back and forth between these as the tree deepens
+  void **eles = arena_alloc(&sim->arena, sim->boids_len*sizeof(void *));
+  void **spare = arena_alloc(&sim->arena, sim->boids_len*sizeof(void *));
+  assert(eles != NULL && spare != NULL);
+  for (size_t i = 0; i < sim->boids_len; ++i) {
+    eles[i] = (void *) &boids[i];
+  }
+
+  qtree_build_task_t *root = arena_alloc(&sim->arena, sizeof(qtree_build_task_t));
+  assert(root != NULL);
+  root->pool = sim->pool;
+  root->scratch = sim->scratch;
+  root->qtree = qtree;
+  root->eles = eles;
+  root->spare = spare;
+  root->len = sim->boids_len;
+  root->depth = 0;
+  root->persist = persist;
+
+  // the root splits off its children, which split off theirs...
+  tpool_add_work(sim->pool, chunk_qtree_build, root);
   tpool_wait(sim->pool);
-  // reset arena/free quadtree
-  arena_clear(&sim->arena);
-  // swap buffers
+
+  return qtree;
+}
+
+static boid_qtree_t *build_boid_qtree(simulation_t *sim, rect_t range) {
+  assert(sim != NULL);
+  boid_qtree_t *qtree = boid_qtree_new(&sim->arena, sim->config.qtree_capacity, range);
+
+  boid_t **eles = arena_alloc(&sim->arena, sim->boids_len*sizeof(boid_t *));
+  boid_t **spare = arena_alloc(&sim->arena, sim->boids_len*sizeof(boid_t *));
+  assert(eles != NULL && spare != NULL);
+  for (size_t i = 0; i < sim->boids_len; ++i) {
+    eles[i] = &sim->boids[i];
+  }
+
+  boid_qtree_build_task_t *root = arena_alloc(&sim->arena, sizeof(boid_qtree_build_task_t));
+  assert(root != NULL);
+  root->pool = sim->pool;
+  root->scratch = sim->scratch;
+  root->qtree = qtree;
+  root->eles = eles;
+  root->spare = spare;
+  root->len = sim->boids_len;
+  root->depth = 0;
+
+  tpool_add_work(sim->pool, chunk_boid_qtree_build, root);
+  tpool_wait(sim->pool);
+
+  return qtree;
+}
+
+static qtree_t *track_qtree(simulation_t *sim, rect_t range) {
+  assert(sim != NULL);
+  size_t len = sim->boids_len;
+
+  // the tree points into tracked, so copying the new generation over it moves
+  // every element in place
+  memcpy(sim->tracked, sim->boids, len*sizeof(boid_t));
+
+  // merges leave their nodes behind in the tree arenas, so start over once
+  // there is about as much garbage as a fresh tree has nodes
+  if (sim->qtree != NULL && sim->tree_garbage <= len/sim->config.qtree_capacity) {
+    size_t merge_len = sim->config.qtree_capacity/MERGE_DIV;
+    qtree_update_stats_t stats = qtree_update(sim->qtree, &sim->tree_arena, merge_len, &sim->tree_pending);
+    assert(stats.len + stats.dropped == len);
+    sim->tree_garbage += stats.merged;
+    if (stats.dropped == 0) {
+      return sim->qtree;
+    }
+    // a boid left the simulation's range, which a rebuild handles like any tick
+  }
+
+  arena_clear(&sim->tree_arena);
+  for (size_t i = 0; i < sim->scratch_len; ++i) {
+    arena_clear(&sim->scratch[i].tree_arena);
+  }
+  sim->tree_garbage = 0;
+  sim->qtree = build_qtree(sim, range, sim->tracked, true);
+  return sim->qtree;
+}
+
+static bool verlet_enabled(const simulation_config_t *config) {
+  return config->skin > 0.0 && !config->aggregate && config->far_radius <= 0.0 &&
+         !config->batch && !config->pairs && config->knn == 0;
+}
+
+static bool verlet_track(simulation_t *sim) {
+  simulation_verlet_t *verlet = &sim->verlet;
+  if (!verlet->valid || verlet->skin != sim->config.skin || verlet->radius != sim->config.hood_radius) {
+    return false;
+  }
+
+  // two boids that each moved at most half the skin closed in by at most the
+  // skin, so whoever is a neighbour now was within the grown neighbourhood;
+  // anyone who moved further is found through the movers grid from now on
+  float half_skin = verlet->skin/2.0;
+  size_t max_movers = sim->boids_len/VERLET_MOVERS_DIV;
+  for (size_t i = 0; i < sim->boids_len; ++i) {
+    v2f_t moved = v2f_sub(sim->boids[i].position, verlet->origins[i]);
+    if (!verlet->moved[i] && v2f_sqr_len(moved) > half_skin*half_skin) {
+      if (verlet->movers_len == max_movers) {
+        return false;
+      }
+      verlet->moved[i] = true;
+      verlet->movers[verlet->movers_len++] = (uint32_t) i;
+    }
+  }
+  return true;
+}
+
+static void bin_movers(simulation_t *sim, rect_t range) {
+  simulation_verlet_t *verlet = &sim->verlet;
+  boid_t **movers = arena_alloc(&sim->arena, verlet->movers_len*sizeof(boid_t *));
+  assert(movers != NULL);
+  for (size_t m = 0; m < verlet->movers_len; ++m) {
+    movers[m] = &sim->boids[verlet->movers[m]];
+  }
+  grid_init(&verlet->movers_grid, range, NEIGHBOURHOOD_WIDTH, NEIGHBOURHOOD_HEIGHT);
+  grid_build(&verlet->movers_grid, &sim->arena, movers, verlet->movers_len, sizeof(boid_t *), boid_ref_point);
+}
+
+static void build_verlet(simulation_t *sim, const boid_chunk_task_t *shared) {
+  assert(sim != NULL);
+  assert(shared != NULL);
+  simulation_verlet_t *verlet = &sim->verlet;
+  size_t len = sim->boids_len;
+  size_t parts = verlet->parts_len;
+
+  query_lists(sim, shared, verlet->parts, parts, verlet->lens, sim->config.skin);
+
+  // the parts are done growing, so the lists can point into them now
+  for (size_t p = 0; p < parts; ++p) {
+    size_t offset = 0;
+    for (size_t i = (len*p)/parts; i < (len*(p + 1))/parts; ++i) {
+      verlet->lists[i] = verlet->parts[p].indices + offset;
+      offset += verlet->lens[i];
+    }
+  }
+
+  for (size_t i = 0; i < len; ++i) {
+    verlet->origins[i] = sim->boids[i].position;
+    verlet->moved[i] = false;
+  }
+  verlet->movers_len = 0;
+
+  float hw = sim->width/2.0, hh = sim->height/2.0;
+  arena_clear(&verlet->arena);
+  grid_init(&verlet->origins_grid, rect_new(v2f(hw, hh), hw, hh), NEIGHBOURHOOD_WIDTH, NEIGHBOURHOOD_HEIGHT);
+  grid_build(&verlet->origins_grid, &verlet->arena, verlet->origins, len, sizeof(v2f_t), origin_point);
+
+  verlet->skin = sim->config.skin;
+  verlet->radius = sim->config.hood_radius;
+  verlet->valid = true;
+}
+
+static bool graph_enabled(const simulation_config_t *config) {
+  return config->graph && !config->aggregate && config->far_radius <= 0.0 &&
+         !config->batch && !config->pairs && config->skin <= 0.0;
+}
+
+static void build_graph(simulation_t *sim, const boid_chunk_task_t *shared) {
+  assert(sim != NULL);
+  assert(shared != NULL);
+  simulation_graph_t *graph = &sim->graph;
+  size_t len = sim->boids_len;
+  size_t parts = sim->graph_parts_len;
+
+  arena_clear(&sim->graph_arena);
+  graph->len = len;
+  graph->offsets = arena_alloc(&sim->graph_arena, (len + 1)*sizeof(uint32_t));
+  assert(graph->offsets != NULL);
+
+  // each list's length lands one past its boid, so summing them up in place
+  // turns them into offsets
+  query_lists(sim, shared, sim->graph_parts, parts, graph->offsets + 1, 0.0);
+  graph->offsets[0] = 0;
+  uint64_t total = 0;
+  for (size_t i = 0; i < len; ++i) {
+    total += graph->offsets[i + 1];
+    assert(total <= UINT32_MAX);
+    graph->offsets[i + 1] = (uint32_t) total;
+  }
+
+  // every part already holds its boids' lists back to back
+  graph->edges_len = (size_t) total;
+  graph->indices = arena_alloc(&sim->graph_arena, graph->edges_len*sizeof(uint32_t));
+  assert(graph->indices != NULL);
+  for (size_t p = 0; p < parts; ++p) {
+    size_t start = (len*p)/parts;
+    memcpy(&graph->indices[graph->offsets[start]], sim->graph_parts[p].indices, sim->graph_parts[p].len*sizeof(uint32_t));
+  }
+}
+
+static void query_lists(
+  simulation_t *sim,
+  const boid_chunk_task_t *shared,
+  simulation_list_part_t *parts,
+  size_t parts_len,
+  uint32_t *lens,
+  float skin
+) {
+  assert(sim != NULL);
+  assert(shared != NULL);
+  size_t len = sim->boids_len;
+
+  boid_chunk_task_t *tasks = arena_alloc(&sim->arena, parts_len*sizeof(boid_chunk_task_t));
+  assert(tasks != NULL);
+  for (size_t p = 0; p < parts_len; ++p) {
+    tasks[p] = *shared;
+    tasks[p].start = (len*p)/parts_len;
+    tasks[p].end = (len*(p + 1))/parts_len;
+    tasks[p].list_part = &parts[p];
+    tasks[p].list_lens = lens;
+    tasks[p].list_skin = skin;
+    tpool_add_work(sim->pool, chunk_boid_update, &tasks[p]);
+  }
+  tpool_wait(sim->pool);
+}
+
+static void reorder_boids(simulation_t *sim) {
+  assert(sim != NULL);
+  size_t len = sim->boids_len;
+  float hw = sim->width/2.0, hh = sim->height/2.0;
+  rect_t sim_range = rect_new(v2f(hw, hh), hw, hh);
+
+  uint32_t *codes = arena_alloc(&sim->arena, len*sizeof(uint32_t));
+  uint32_t *order = arena_alloc(&sim->arena, len*sizeof(uint32_t));
+  assert(codes != NULL && order != NULL);
+  for (size_t i = 0; i < len; ++i) {
+    codes[i] = morton_code(sim_range, sim->boids[i].position);
+    order[i] = (uint32_t) i;
+  }
+
+  morton_sort(sim->pool, sim->thread_count, &sim->arena, codes, order, len);
+
+  // gather everything indexed per boid into sorted order, reusing the swap
+  // buffer for boids and codes (no longer needed) for the rest
+  for (size_t i = 0; i < len; ++i) {
+    sim->boids_swap[i] = sim->boids[order[i]];
+  }
   swap_buffers(sim);
+  if (sim->config.layout == SIMULATION_LAYOUT_SOA) {
+    boid_soa_load(&sim->soa, sim->boids, len);
+  }
+
+  for (size_t i = 0; i < len; ++i) {
+    codes[i] = sim->ids[order[i]];
+  }
+  for (size_t i = 0; i < len; ++i) {
+    sim->ids[i] = codes[i];
+  }
+
+  for (size_t i = 0; i < len; ++i) {
+    codes[i] = sim->costs[order[i]];
+  }
+  for (size_t i = 0; i < len; ++i) {
+    sim->costs[i] = codes[i];
+  }
+
+  // the persistent quadtree's slots now hold different boids, cheaper to rebuild
+  sim->qtree = NULL;
+  // and so do the cached neighbour lists' and graph's indices
+  sim->verlet.valid = false;
+  sim->graph.len = 0;
+
+  arena_clear(&sim->arena);
 }
 
 static void constrain_boids(simulation_t *sim) {
   assert(sim != NULL);
+  bool soa = sim->config.layout == SIMULATION_LAYOUT_SOA;
   for (size_t i = 0; i < sim->boids_len; ++i) {
     boid_t *curr = &sim->boids[i];
     float cx = curr->position.x, cy = curr->position.y;
@@ -150,6 +1115,11 @@ static void constrain_boids(simulation_t *sim) {
     if (cy > sim->height) {
       curr->position.y = 0;
     }
+    if (soa) {
+      // keep the columns in step with any wrapping
+      sim->soa.px[i] = curr->position.x;
+      sim->soa.py[i] = curr->position.y;
+    }
   }
 }
 
@@ -159,57 +1129,763 @@ static void swap_buffers(simulation_t *sim) {
   boid_t *temp_boids = sim->boids;
   sim->boids = sim->boids_swap;
   sim->boids_swap = temp_boids;
+  // and their columns with them
+  boid_soa_t temp_soa = sim->soa;
+  sim->soa = sim->soa_swap;
+  sim->soa_swap = temp_soa;
+}
+
+static void update_range(const boid_chunk_task_t *task, size_t start, size_t end) {
+  boid_t *buffer = task->buffer;
+  boid_t *swap = task->swap;
+
+  if (task->verlet != NULL) {
+    update_from_lists(task, start, end);
+    return;
+  }
+
+  if (task->graph != NULL) {
+    update_from_graph(task, start, end);
+    return;
+  }
+
+  if (task->pair_sums != NULL) {
+    // the neighbourhoods are summed already
+    for (size_t i = start; i < end; ++i) {
+      boid_sums_t sums = task->pair_sums[i];
+      move_boid(&swap[i], buffer[i], finish_deltas(buffer[i], sums), task);
+      task->costs[i] = sums.count > UINT32_MAX ? UINT32_MAX : (uint32_t) sums.count;
+    }
+    return;
+  }
+
+  for (size_t i = start; i < end; ++i) {
+    size_t neighbours_len = update_boid_into_swap(&swap[i], buffer[i], i, task);
+    task->costs[i] = neighbours_len > UINT32_MAX ? UINT32_MAX : (uint32_t) neighbours_len;
+  }
+}
+
+static void build_lists(const boid_chunk_task_t *task) {
+  size_t worker = tpool_worker_index();
+  assert(worker != TPOOL_NO_WORKER);
+  simulation_scratch_t *scratch = &task->scratch[worker];
+  simulation_list_part_t *part = task->list_part;
+  float skin = task->list_skin;
+  float radius = task->config->hood_radius;
+
+  part->len = 0;
+  for (size_t i = task->start; i < task->end; ++i) {
+    boid_t boid = task->buffer[i];
+    size_t found_len = 0;
+    if (task->config->knn > 0) {
+      found_len = query_nearest(task, boid.position, scratch);
+    } else if (radius > 0.0) {
+      found_len = query_radius(task, boid.position, radius + skin, scratch);
+    } else {
+      rect_t hood = boid_neighbourhood(boid);
+      rect_t grown = rect_new(hood.center, hood.half_width + skin, hood.half_height + skin);
+      found_len = query_neighbours(task, grown, boid.position, scratch, NULL, false);
+    }
+
+    if (part->len + found_len > part->capacity) {
+      part->capacity = 2*(part->len + found_len);
+      part->indices = realloc(part->indices, part->capacity*sizeof(uint32_t));
+      assert(part->indices != NULL);
+    }
+    for (size_t j = 0; j < found_len; ++j) {
+      part->indices[part->len++] = (uint32_t) (scratch->neighbours[j] - task->buffer);
+    }
+    task->list_lens[i] = (uint32_t) found_len;
+  }
+}
+
+static void update_from_graph(const boid_chunk_task_t *task, size_t start, size_t end) {
+  size_t worker = tpool_worker_index();
+  assert(worker != TPOOL_NO_WORKER);
+  simulation_scratch_t *scratch = &task->scratch[worker];
+  const simulation_graph_t *graph = task->graph;
+  boid_t *buffer = task->buffer;
+
+  for (size_t i = start; i < end; ++i) {
+    boid_t src = buffer[i];
+    size_t neighbours_len = graph->offsets[i + 1] - graph->offsets[i];
+    if (neighbours_len > scratch->capacity) {
+      scratch->capacity = 2*neighbours_len;
+      scratch->neighbours = realloc(scratch->neighbours, scratch->capacity*sizeof(boid_t *));
+      assert(scratch->neighbours != NULL);
+    }
+    const uint32_t *indices = &graph->indices[graph->offsets[i]];
+    for (size_t j = 0; j < neighbours_len; ++j) {
+      scratch->neighbours[j] = &buffer[indices[j]];
+    }
+
+    boid_sums_t sums = sum_found(src, i, task, scratch->neighbours, neighbours_len);
+    move_boid(&task->swap[i], src, finish_deltas(src, sums), task);
+    task->costs[i] = neighbours_len > UINT32_MAX ? UINT32_MAX : (uint32_t) neighbours_len;
+  }
+}
+
+static void update_from_lists(const boid_chunk_task_t *task, size_t start, size_t end) {
+  size_t worker = tpool_worker_index();
+  assert(worker != TPOOL_NO_WORKER);
+  simulation_scratch_t *scratch = &task->scratch[worker];
+  simulation_verlet_t *verlet = task->verlet;
+  boid_t *buffer = task->buffer;
+  float radius = task->config->hood_radius;
+
+  for (size_t i = start; i < end; ++i) {
+    boid_t src = buffer[i];
+    rect_t hood = boid_neighbourhood(src);
+    if (radius > 0.0) {
+      hood = rect_new(src.position, radius, radius);
+    }
+
+    // candidates that stayed put: from our list, or for a mover whose list
+    // is stale, from around where everyone was when the lists were built
+    size_t candidates_len = 0;
+    if (!verlet->moved[i]) {
+      size_t list_len = verlet->lens[i];
+      if (list_len > scratch->capacity) {
+        scratch->capacity = 2*list_len;
+        scratch->neighbours = realloc(scratch->neighbours, scratch->capacity*sizeof(boid_t *));
+        assert(scratch->neighbours != NULL);
+      }
+      for (size_t j = 0; j < list_len; ++j) {
+        scratch->neighbours[candidates_len++] = &buffer[verlet->lists[i][j]];
+      }
+    } else {
+      rect_t grown = rect_new(hood.center, hood.half_width + verlet->skin, hood.half_height + verlet->skin);
+      candidates_len = append_grid_query(scratch, 0, &verlet->origins_grid, grown);
+      for (size_t j = 0; j < candidates_len; ++j) {
+        const v2f_t *origin = (const v2f_t *) scratch->neighbours[j];
+        scratch->neighbours[j] = &buffer[origin - verlet->origins];
+      }
+    }
+
+    size_t neighbours_len = 0;
+    for (size_t j = 0; j < candidates_len; ++j) {
+      boid_t *other = scratch->neighbours[j];
+      // movers are wherever the movers grid says they are now
+      if (verlet->moved[other - buffer]) {
+        continue;
+      }
+      bool near = radius > 0.0
+        ? v2f_sqr_len(v2f_sub(other->position, src.position)) <= radius*radius
+        : rect_contains_point(hood, other->position);
+      if (near) {
+        scratch->neighbours[neighbours_len++] = other;
+      }
+    }
+
+    size_t movers_beg = neighbours_len;
+    size_t movers_end = append_grid_query(scratch, movers_beg, &verlet->movers_grid, hood);
+    for (size_t j = movers_beg; j < movers_end; ++j) {
+      boid_t *other = *(boid_t **) scratch->neighbours[j];
+      if (radius <= 0.0 || v2f_sqr_len(v2f_sub(other->position, src.position)) <= radius*radius) {
+        scratch->neighbours[neighbours_len++] = other;
+      }
+    }
+
+    boid_sums_t sums = sum_found(src, i, task, scratch->neighbours, neighbours_len);
+    move_boid(&task->swap[i], src, finish_deltas(src, sums), task);
+    task->costs[i] = neighbours_len > UINT32_MAX ? UINT32_MAX : (uint32_t) neighbours_len;
+  }
+}
+
+static size_t append_grid_query(simulation_scratch_t *scratch, size_t len, grid_t *grid, rect_t range) {
+  for (;;) {
+    void **found = (void **) scratch->neighbours + len;
+    size_t found_len = grid_query_into(grid, range, found, scratch->capacity - len);
+    if (len + found_len <= scratch->capacity) {
+      return len + found_len;
+    }
+    scratch->capacity = 2*(len + found_len);
+    scratch->neighbours = realloc(scratch->neighbours, scratch->capacity*sizeof(boid_t *));
+    assert(scratch->neighbours != NULL);
+  }
+}
+
+static void update_leaf(const boid_chunk_task_t *task, fqtree_leaf_t leaf) {
+  assert(task->fqtree != NULL);
+  assert(leaf.len > 0);
+  size_t worker = tpool_worker_index();
+  assert(worker != TPOOL_NO_WORKER);
+  simulation_scratch_t *scratch = &task->scratch[worker];
+  boid_t **members = (boid_t **) task->fqtree->items + leaf.first;
+  const v2f_t *points = task->fqtree->points + leaf.first;
+
+  // every member's neighbourhood lies within the box around all the members
+  // grown by how far a boid looks
+  v2f_t lo = points[0], hi = points[0];
+  for (size_t i = 1; i < leaf.len; ++i) {
+    lo = v2f(fminf(lo.x, points[i].x), fminf(lo.y, points[i].y));
+    hi = v2f(fmaxf(hi.x, points[i].x), fmaxf(hi.y, points[i].y));
+  }
+  float radius = task->config->hood_radius;
+  float reach_x = radius > 0.0 ? radius : NEIGHBOURHOOD_WIDTH/2.0;
+  float reach_y = radius > 0.0 ? radius : NEIGHBOURHOOD_HEIGHT/2.0;
+  rect_t range = rect_new(
+    v2f((lo.x + hi.x)/2.0, (lo.y + hi.y)/2.0),
+    (hi.x - lo.x)/2.0 + reach_x + BATCH_SLACK,
+    (hi.y - lo.y)/2.0 + reach_y + BATCH_SLACK
+  );
+  size_t candidates_len = query_neighbours(task, range, range.center, scratch, NULL, false);
+  load_candidates(scratch, candidates_len);
+
+  for (size_t i = 0; i < leaf.len; ++i) {
+    boid_t src = *members[i];
+    size_t neighbours_len = filter_candidates(scratch, candidates_len, src, radius);
+    size_t index = (size_t) (members[i] - task->buffer);
+    boid_sums_t sums = sum_found(src, index, task, scratch->neighbours, neighbours_len);
+
+    move_boid(&task->swap[index], src, finish_deltas(src, sums), task);
+    task->costs[index] = neighbours_len > UINT32_MAX ? UINT32_MAX : (uint32_t) neighbours_len;
+  }
+}
+
+static void load_candidates(simulation_scratch_t *scratch, size_t candidates_len) {
+  if (candidates_len > scratch->candidates_capacity) {
+    // the neighbours grew to fit, so can we
+    scratch->candidates_capacity = scratch->capacity;
+    scratch->candidates = realloc(scratch->candidates, scratch->candidates_capacity*sizeof(boid_t *));
+    scratch->candidates_x = realloc(scratch->candidates_x, scratch->candidates_capacity*sizeof(float));
+    scratch->candidates_y = realloc(scratch->candidates_y, scratch->candidates_capacity*sizeof(float));
+    assert(scratch->candidates != NULL);
+    assert(scratch->candidates_x != NULL && scratch->candidates_y != NULL);
+  }
+  for (size_t j = 0; j < candidates_len; ++j) {
+    boid_t *candidate = scratch->neighbours[j];
+    scratch->candidates[j] = candidate;
+    scratch->candidates_x[j] = candidate->position.x;
+    scratch->candidates_y[j] = candidate->position.y;
+  }
+}
+
+static size_t filter_candidates(simulation_scratch_t *scratch, size_t candidates_len, boid_t boid, float radius) {
+  // neighbours never outnumber the candidates they were picked from, which
+  // are themselves the result of a query into neighbours
+  assert(candidates_len <= scratch->capacity);
+  boid_t **candidates = scratch->candidates;
+  const float *xs = scratch->candidates_x;
+  const float *ys = scratch->candidates_y;
+  boid_t **neighbours = scratch->neighbours;
+  size_t len = 0;
+
+  // branchless: every candidate is written, but only kept ones advance len
+  if (radius > 0.0) {
+    // the same test query_radius filters a square query with
+    float bx = boid.position.x, by = boid.position.y;
+    float sqr_radius = radius*radius;
+    for (size_t j = 0; j < candidates_len; ++j) {
+      float dx = xs[j] - bx;
+      float dy = ys[j] - by;
+      neighbours[len] = candidates[j];
+      len += (dx*dx + dy*dy <= sqr_radius);
+    }
+  } else {
+    // the same bounds rect_contains_point tests a neighbourhood against
+    rect_t hood = boid_neighbourhood(boid);
+    float left = hood.center.x - hood.half_width, right = hood.center.x + hood.half_width;
+    float top = hood.center.y - hood.half_height, bottom = hood.center.y + hood.half_height;
+    for (size_t j = 0; j < candidates_len; ++j) {
+      neighbours[len] = candidates[j];
+      len += (xs[j] >= left) & (xs[j] <= right) & (ys[j] >= top) & (ys[j] <= bottom);
+    }
+  }
+
+  return len;
 }
 
-static void update_boid_into_swap(boid_t *dest, const boid_t src, qtree_t *qtree, float dt) {
+static size_t update_boid_into_swap(boid_t *dest, const boid_t src, size_t index, const boid_chunk_task_t *task) {
   assert(dest != NULL);
   // now calculate deltas and update given acceleration
-  boid_update_t update = calculate_deltas(src, qtree);
-  v2f_t acceleration = v2f_mul(calculate_acceleration(update), v2ff(dt));
+  size_t neighbours_len = 0;
+  boid_update_t update = calculate_deltas(src, index, task, &neighbours_len);
+  move_boid(dest, src, update, task);
+  return neighbours_len;
+}
+
+static void move_boid(boid_t *dest, const boid_t src, boid_update_t update, const boid_chunk_task_t *task) {
+  assert(dest != NULL);
+  float dt = task->dt;
+  v2f_t acceleration = v2f_mul(calculate_acceleration(update, task->config), v2ff(dt));
   dest->velocity = limit_magnitude(v2f_add(src.velocity, acceleration), MAX_SPEED);
   dest->position = v2f_add(src.position, v2f_mul(src.velocity, v2ff(dt)));
+  if (task->soa_swap != NULL) {
+    boid_soa_store(task->soa_swap, (size_t) (dest - task->swap), *dest);
+  }
 }
 
-static boid_update_t calculate_deltas(boid_t boid, qtree_t *qtree) {
-  // initially we have deltas of 0
-  boid_update_t update = {0};
+static boid_update_t calculate_deltas(boid_t boid, size_t index, const boid_chunk_task_t *task, size_t *out_count) {
+  size_t worker = tpool_worker_index();
+  assert(worker != TPOOL_NO_WORKER);
+  simulation_scratch_t *scratch = &task->scratch[worker];
+
+  if (task->typed != NULL && task->config->stream && task->config->hood_radius <= 0.0 && task->config->knn == 0) {
+    // no neighbour list at all, the traversal does the summing
+    neighbour_visit_t visit = {0};
+    visit.boid = boid;
+    boid_qtree_visit_neighbours(task->typed, boid_neighbourhood(boid), &visit);
+    *out_count = visit.sums.count;
+    return finish_deltas(boid, visit.sums);
+  }
+
+  // subtrees beyond separation range only contribute totals, so they can be
+  // summed in bulk without changing the result
+  fqtree_aggregate_t aggregate = {0}, *aggregate_ptr = NULL;
+  bool summed = task->fqtree != NULL && task->fqtree->sums != NULL;
+  if (summed && task->config->knn == 0) {
+    aggregate_ptr = &aggregate;
+  }
 
-  rect_t neighbourhood = boid_neighbourhood(boid);
   size_t neighbours_len = 0;
-  boid_t **neighbours = (boid_t **) qtree_query(qtree, neighbourhood, &neighbours_len);
+  if (task->config->knn > 0) {
+    // bounded by knn however crowded it gets, and node totals don't apply
+    neighbours_len = query_nearest(task, boid.position, scratch);
+  } else if (task->config->hood_radius > 0.0) {
+    // node totals can't tell which of their boids fall inside a circle
+    neighbours_len = query_radius(task, boid.position, task->config->hood_radius, scratch);
+  } else {
+    rect_t neighbourhood = boid_neighbourhood(boid);
+    neighbours_len = query_neighbours(task, neighbourhood, boid.position, scratch, aggregate_ptr, false);
+  }
+  *out_count = neighbours_len;
+
+  boid_sums_t sums = sum_found(boid, index, task, scratch->neighbours, neighbours_len);
+  sums.alignment = v2f_add(sums.alignment, aggregate.values);
+  sums.cohesion = v2f_add(sums.cohesion, aggregate.points);
+  sums.count += aggregate.count;
 
-  size_t update_count = 0;
-  for (size_t i = 0; i < neighbours_len; ++i, ++update_count) {
-    boid_t other = *neighbours[i];
+  if (summed && task->config->far_radius > 0.0) {
+    // separation stays local, alignment and cohesion look much further out
+    float radius = task->config->far_radius;
+    rect_t far_range = rect_new(boid.position, radius, radius);
+    size_t far_len = query_neighbours(task, far_range, boid.position, scratch, &aggregate, true);
+    *out_count += far_len;
 
-    if (boid.position.x == other.position.x && boid.position.y == other.position.y) {
-      continue;
+    boid_sums_t far_sums = sum_found(boid, index, task, scratch->neighbours, far_len);
+    sums.alignment = v2f_add(far_sums.alignment, aggregate.values);
+    sums.cohesion = v2f_add(far_sums.cohesion, aggregate.points);
+    sums.count = far_sums.count + aggregate.count;
+  }
+
+  return finish_deltas(boid, sums);
+}
+
+static size_t query_nearest(const boid_chunk_task_t *task, v2f_t origin, simulation_scratch_t *scratch) {
+  // the boid itself is its own nearest neighbour, and counts like it does in
+  // a neighbourhood
+  size_t k = task->config->knn + 1;
+  void *found[KNN_MAX + 1];
+  float sqr_dists[KNN_MAX + 1];
+  assert(k <= KNN_MAX + 1);
+
+  size_t found_len = 0;
+  if (task->qtree != NULL) {
+    found_len = qtree_query_nearest(task->qtree, origin, k, boid_point, found, sqr_dists);
+  } else if (task->fqtree != NULL) {
+    found_len = fqtree_query_nearest(task->fqtree, origin, k, found, sqr_dists);
+  } else {
+    // the grid and typed quadtree only answer box queries, so widen the box
+    // until the k-th nearest within it is no farther than its edge
+    float half = NEIGHBOURHOOD_WIDTH/2.0;
+    float max_half = fmaxf(task->config->width, task->config->height);
+    for (;;) {
+      rect_t square = rect_new(origin, half, half);
+      size_t square_len = query_neighbours(task, square, origin, scratch, NULL, false);
+      nearest_t nearest;
+      nearest_init(&nearest, k, found, sqr_dists);
+      for (size_t i = 0; i < square_len; ++i) {
+        boid_t *other = scratch->neighbours[i];
+        nearest_offer(&nearest, other, v2f_sqr_len(v2f_sub(other->position, origin)));
+      }
+      // compared as a distance, as that is what the box is widened to
+      float reach = sqrtf(nearest_bound(&nearest));
+      if (reach <= half || half >= max_half) {
+        found_len = nearest_sort(&nearest);
+        break;
+      }
+      // too few to be sure (reach is infinite) or the k-th might be beaten
+      // by someone outside the box
+      half = isinf(reach) ? 2.0*half : reach;
     }
+  }
 
-    // separation
-    float dist = boid_sqr_distance(boid, other);
-    if (dist < (NEIGHBOURHOOD_WIDTH * NEIGHBOURHOOD_HEIGHT) / 9.0) {
-      v2f_t diff = v2f_sub(boid.position, other.position);
-      float mag_diff = v2f_len(diff);
-      v2f_t norm_diff = safe_v2f_div(diff, v2ff(mag_diff));
-      update.separation = v2f_add(update.separation, safe_v2f_div(norm_diff, v2ff(mag_diff)));
+  if (scratch->capacity < found_len) {
+    scratch->capacity = found_len;
+    scratch->neighbours = realloc(scratch->neighbours, scratch->capacity*sizeof(boid_t *));
+    assert(scratch->neighbours != NULL);
+  }
+  for (size_t i = 0; i < found_len; ++i) {
+    scratch->neighbours[i] = found[i];
+  }
+  return found_len;
+}
+
+static boid_sums_t sum_found(
+  boid_t boid,
+  size_t index,
+  const boid_chunk_task_t *task,
+  boid_t **neighbours,
+  size_t neighbours_len
+) {
+  size_t sample_len = neighbours_len;
+  if (task->config->sample > 0 && neighbours_len > task->config->sample) {
+    // keyed by who the boid is rather than where, so boids piled onto one
+    // point still draw different subsamples, and by tick so they change
+    uint32_t seed = sample_hash(task->ids[index] ^ sample_hash((uint32_t) task->tick));
+    sample_len = sample_neighbours(task, seed, neighbours, neighbours_len, task->config->sample);
+  }
+
+  boid_sums_t sums;
+  if (task->soa != NULL) {
+    sums = sum_neighbours_soa(boid, task->soa, task->buffer, neighbours, sample_len);
+  } else {
+    sums = sum_neighbours(boid, neighbours, sample_len);
+  }
+
+  if (sample_len < neighbours_len) {
+    sums = reweight_sums(sums, neighbours_len);
+  }
+  return sums;
+}
+
+static size_t sample_neighbours(
+  const boid_chunk_task_t *task,
+  uint32_t seed,
+  boid_t **neighbours,
+  size_t neighbours_len,
+  size_t sample_len
+) {
+  assert(sample_len > 0 && sample_len < neighbours_len);
+  // keys are uniform over 32 bits, so each neighbour is kept with probability
+  // sample_len/neighbours_len; a threshold rather than picking the lowest
+  // sample_len keys keeps this a single pass without unpredictable branches
+  uint64_t limit = ((uint64_t) sample_len << 32)/neighbours_len;
+  boid_t *lowest = neighbours[0];
+  uint32_t lowest_key = sample_key(task, seed, lowest);
+  size_t kept = 0;
+  for (size_t j = 0; j < neighbours_len; ++j) {
+    boid_t *neighbour = neighbours[j];
+    uint32_t key = sample_key(task, seed, neighbour);
+    if (key < lowest_key) {
+      lowest = neighbour;
+      lowest_key = key;
     }
+    neighbours[kept] = neighbour;
+    kept += (uint64_t) key < limit;
+  }
 
-    // alignment
-    update.alignment = v2f_add(update.alignment, other.velocity);
+  // an empty subsample would say nothing about the neighbourhood
+  if (kept == 0) {
+    neighbours[0] = lowest;
+    kept = 1;
+  }
+  return kept;
+}
 
-    // cohesion
-    update.cohesion = v2f_add(update.cohesion, other.position);
+static uint32_t sample_key(const boid_chunk_task_t *task, uint32_t seed, const boid_t *other) {
+  return sample_hash(seed ^ task->ids[other - task->buffer]);
+}
+
+static boid_sums_t reweight_sums(boid_sums_t sums, size_t neighbours_len) {
+  if (sums.count == 0) {
+    return sums;
+  }
+  // every neighbour adds one to count, so the sums scale by what we skipped;
+  // averages stay those of the subsample, and totals added on top (node
+  // aggregates) are weighed against the whole neighbourhood
+  v2f_t weight = v2ff((float) neighbours_len/(float) sums.count);
+  sums.separation = v2f_mul(sums.separation, weight);
+  sums.alignment = v2f_mul(sums.alignment, weight);
+  sums.cohesion = v2f_mul(sums.cohesion, weight);
+  sums.count = neighbours_len;
+  return sums;
+}
+
+static uint32_t sample_hash(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+static size_t query_neighbours(
+  const boid_chunk_task_t *task,
+  rect_t range,
+  v2f_t origin,
+  simulation_scratch_t *scratch,
+  fqtree_aggregate_t *aggregate,
+  bool far
+) {
+  const float separation_sqr = (NEIGHBOURHOOD_WIDTH * NEIGHBOURHOOD_HEIGHT) / 9.0;
+  for (;;) {
+    void **found = (void **) scratch->neighbours;
+    size_t found_len = 0;
+    if (aggregate != NULL && far) {
+      found_len = fqtree_query_far(
+        task->fqtree, range, origin, task->config->far_theta, found, scratch->capacity, aggregate
+      );
+    } else if (aggregate != NULL) {
+      found_len = fqtree_query_aggregate(
+        task->fqtree, range, origin, separation_sqr, found, scratch->capacity, aggregate
+      );
+    } else if (task->grid != NULL) {
+      found_len = grid_query_into(task->grid, range, found, scratch->capacity);
+    } else if (task->fqtree != NULL) {
+      found_len = fqtree_query_into(task->fqtree, range, found, scratch->capacity);
+    } else if (task->typed != NULL) {
+      found_len = boid_qtree_query_into(task->typed, range, scratch->neighbours, scratch->capacity);
+    } else {
+      found_len = qtree_query_into(task->qtree, range, found, scratch->capacity);
+    }
+    if (found_len <= scratch->capacity) {
+      return found_len;
+    }
+    // overflowed, grow with some headroom (only until the densest flock fits)
+    scratch->capacity = 2*found_len;
+    scratch->neighbours = realloc(scratch->neighbours, scratch->capacity*sizeof(boid_t *));
+    assert(scratch->neighbours != NULL);
+  }
+}
+
+static size_t query_radius(
+  const boid_chunk_task_t *task,
+  v2f_t origin,
+  float radius,
+  simulation_scratch_t *scratch
+) {
+  if (task->qtree == NULL) {
+    // query the square around the circle, then drop its corners
+    rect_t square = rect_new(origin, radius, radius);
+    size_t square_len = query_neighbours(task, square, origin, scratch, NULL, false);
+    size_t found_len = 0;
+    for (size_t i = 0; i < square_len; ++i) {
+      boid_t *other = scratch->neighbours[i];
+      if (v2f_sqr_len(v2f_sub(other->position, origin)) <= radius*radius) {
+        scratch->neighbours[found_len++] = other;
+      }
+    }
+    return found_len;
+  }
+
+  for (;;) {
+    void **found = (void **) scratch->neighbours;
+    size_t found_len = qtree_query_radius_into(task->qtree, origin, radius, boid_point, found, scratch->capacity);
+    if (found_len <= scratch->capacity) {
+      return found_len;
+    }
+    scratch->capacity = 2*found_len;
+    scratch->neighbours = realloc(scratch->neighbours, scratch->capacity*sizeof(boid_t *));
+    assert(scratch->neighbours != NULL);
+  }
+}
+
+static boid_sums_t sum_neighbours(boid_t boid, boid_t **neighbours, size_t neighbours_len) {
+  // initially we have sums of 0
+  boid_sums_t sums = {0};
+
+  for (size_t i = 0; i < neighbours_len; ++i) {
+    accumulate_neighbour(&sums, boid, neighbours[i]);
+  }
+
+  return sums;
+}
+
+static void accumulate_neighbour(boid_sums_t *sums, boid_t boid, const boid_t *other) {
+  // every neighbour counts, even one at our own position
+  sums->count += 1;
+
+  if (boid.position.x == other->position.x && boid.position.y == other->position.y) {
+    return;
   }
 
-  // we are done with our search
-  free(neighbours);
+  // separation
+  float dist = boid_sqr_distance(boid, *other);
+  if (dist < (NEIGHBOURHOOD_WIDTH * NEIGHBOURHOOD_HEIGHT) / 9.0) {
+    v2f_t diff = v2f_sub(boid.position, other->position);
+    float mag_diff = v2f_len(diff);
+    v2f_t norm_diff = safe_v2f_div(diff, v2ff(mag_diff));
+    sums->separation = v2f_add(sums->separation, safe_v2f_div(norm_diff, v2ff(mag_diff)));
+  }
+
+  // alignment
+  sums->alignment = v2f_add(sums->alignment, other->velocity);
+
+  // cohesion
+  sums->cohesion = v2f_add(sums->cohesion, other->position);
+}
+
+static void accumulate_pair(boid_sums_t *a_sums, const boid_t *a, boid_sums_t *b_sums, const boid_t *b) {
+  a_sums->count += 1;
+  b_sums->count += 1;
+
+  if (a->position.x == b->position.x && a->position.y == b->position.y) {
+    return;
+  }
+
+  // separation, the push on b being exactly the opposite of the push on a
+  float dist = boid_sqr_distance(*a, *b);
+  if (dist < (NEIGHBOURHOOD_WIDTH * NEIGHBOURHOOD_HEIGHT) / 9.0) {
+    v2f_t diff = v2f_sub(a->position, b->position);
+    float mag_diff = v2f_len(diff);
+    v2f_t norm_diff = safe_v2f_div(diff, v2ff(mag_diff));
+    v2f_t push = safe_v2f_div(norm_diff, v2ff(mag_diff));
+    a_sums->separation = v2f_add(a_sums->separation, push);
+    b_sums->separation = v2f_sub(b_sums->separation, push);
+  }
+
+  // alignment
+  a_sums->alignment = v2f_add(a_sums->alignment, b->velocity);
+  b_sums->alignment = v2f_add(b_sums->alignment, a->velocity);
+
+  // cohesion
+  a_sums->cohesion = v2f_add(a_sums->cohesion, b->position);
+  b_sums->cohesion = v2f_add(b_sums->cohesion, a->position);
+}
+
+static void accumulate_row(const boid_pair_task_t *task, size_t row) {
+  const grid_t *grid = task->grid;
+  boid_sums_t *sums = task->sums;
+  const boid_t *buffer = task->buffer;
+  const size_t *cell_start = grid->cell_start;
+  size_t cols = grid->cols;
+
+  for (size_t col = 0; col < cols; ++col) {
+    size_t cell = row*cols + col;
+    size_t right = col + 1 < cols ? col + 1 : col;
+    size_t left = col > 0 ? col - 1 : col;
+    // later boids of this cell and the whole cell to our right are one span,
+    // and so are the three cells below us; together with the boids before us
+    // and the cells above and to our left (who visit us) that covers every
+    // neighbour exactly once
+    size_t same_end = cell_start[row*cols + right + 1];
+    size_t below_beg = 0, below_end = 0;
+    if (row + 1 < grid->rows) {
+      below_beg = cell_start[(row + 1)*cols + left];
+      below_end = cell_start[(row + 1)*cols + right + 1];
+    }
+
+    for (size_t i = cell_start[cell]; i < cell_start[cell + 1]; ++i) {
+      const boid_t *a = grid->items[i];
+      size_t a_index = (size_t) (a - buffer);
+      // we are in our own neighbourhood
+      sums[a_index].count += 1;
+
+      rect_t hood = boid_neighbourhood(*a);
+      for (size_t j = i + 1; j < same_end; ++j) {
+        if (rect_contains_point(hood, grid->points[j])) {
+          const boid_t *b = grid->items[j];
+          accumulate_pair(&sums[a_index], a, &sums[b - buffer], b);
+        }
+      }
+      for (size_t j = below_beg; j < below_end; ++j) {
+        if (rect_contains_point(hood, grid->points[j])) {
+          const boid_t *b = grid->items[j];
+          accumulate_pair(&sums[a_index], a, &sums[b - buffer], b);
+        }
+      }
+    }
+  }
+}
+
+static void visit_neighbour(neighbour_visit_t *visit, boid_t *other, v2f_t point) {
+  // the tree's copy of the position is the one in other, we need its velocity anyway
+  (void) point;
+  accumulate_neighbour(&visit->sums, visit->boid, other);
+}
+
+static boid_sums_t sum_neighbours_soa(
+  boid_t boid,
+  const boid_soa_t *soa,
+  const boid_t *buffer,
+  boid_t **neighbours,
+  size_t neighbours_len
+) {
+  assert(soa != NULL);
+  const float bx = boid.position.x, by = boid.position.y;
+  const float separation_sqr = (NEIGHBOURHOOD_WIDTH * NEIGHBOURHOOD_HEIGHT) / 9.0;
+
+  // one partial sum per lane, only folded together at the very end; keeping
+  // lanes independent lets the compiler vectorize without reassociating floats
+  _Alignas(BOID_SOA_ALIGN) float sx[KERNEL_LANES] = {0}, sy[KERNEL_LANES] = {0};
+  _Alignas(BOID_SOA_ALIGN) float ax[KERNEL_LANES] = {0}, ay[KERNEL_LANES] = {0};
+  _Alignas(BOID_SOA_ALIGN) float cx[KERNEL_LANES] = {0}, cy[KERNEL_LANES] = {0};
+
+  _Alignas(BOID_SOA_ALIGN) float px[KERNEL_BATCH], py[KERNEL_BATCH];
+  _Alignas(BOID_SOA_ALIGN) float vx[KERNEL_BATCH], vy[KERNEL_BATCH];
+
+  for (size_t base = 0; base < neighbours_len; base += KERNEL_BATCH) {
+    size_t batch_len = neighbours_len - base;
+    if (batch_len > KERNEL_BATCH) batch_len = KERNEL_BATCH;
 
-  if (update_count > 0) {
+    // gather neighbours into lanes, padding the tail with copies of ourselves
+    // (a boid at our own position contributes nothing, as in sum_neighbours)
+    size_t padded_len = ((batch_len + KERNEL_LANES - 1)/KERNEL_LANES)*KERNEL_LANES;
+    for (size_t j = 0; j < batch_len; ++j) {
+      size_t index = (size_t) (neighbours[base + j] - buffer);
+      px[j] = soa->px[index];
+      py[j] = soa->py[index];
+      vx[j] = soa->vx[index];
+      vy[j] = soa->vy[index];
+    }
+    for (size_t j = batch_len; j < padded_len; ++j) {
+      px[j] = bx;
+      py[j] = by;
+      vx[j] = 0.0;
+      vy[j] = 0.0;
+    }
+
+    for (size_t j = 0; j < padded_len; j += KERNEL_LANES) {
+      for (size_t k = 0; k < KERNEL_LANES; ++k) {
+        float dx = bx - px[j + k];
+        float dy = by - py[j + k];
+        float dist = dx*dx + dy*dy;
+        // branchless masks, a weight of 0 drops the neighbour from that sum;
+        // no short-circuiting, and isless as a plain < may trap on nan, either
+        // of which leaves control flow the vectorizer gives up on
+        float other = (float) ((dx != 0.0f) | (dy != 0.0f));
+        float close = other*(float) isless(dist, separation_sqr);
+        // 1/dist where close, and 0/1 (never a division by zero) elsewhere
+        float near = close/(dist + (1.0f - close));
+
+        // separation
+        sx[k] += dx*near;
+        sy[k] += dy*near;
+
+        // alignment
+        ax[k] += vx[j + k]*other;
+        ay[k] += vy[j + k]*other;
+
+        // cohesion
+        cx[k] += px[j + k]*other;
+        cy[k] += py[j + k]*other;
+      }
+    }
+  }
+
+  boid_sums_t sums = {0};
+  for (size_t k = 0; k < KERNEL_LANES; ++k) {
+    sums.separation = v2f_add(sums.separation, v2f(sx[k], sy[k]));
+    sums.alignment = v2f_add(sums.alignment, v2f(ax[k], ay[k]));
+    sums.cohesion = v2f_add(sums.cohesion, v2f(cx[k], cy[k]));
+  }
+  sums.count = neighbours_len;
+
+  return sums;
+}
+
+static boid_update_t finish_deltas(boid_t boid, boid_sums_t sums) {
+  // initially we have deltas of 0
+  boid_update_t update = {0};
+
+  if (sums.count > 0) {
     // average over count
-    update.separation = safe_v2f_div(update.separation, v2ff((float) update_count));
-    update.alignment = safe_v2f_div(update.alignment, v2ff((float) update_count));
-    update.cohesion = safe_v2f_div(update.cohesion, v2ff((float) update_count));
+    update.separation = safe_v2f_div(sums.separation, v2ff((float) sums.count));
+    update.alignment = safe_v2f_div(sums.alignment, v2ff((float) sums.count));
+    update.cohesion = safe_v2f_div(sums.cohesion, v2ff((float) sums.count));
 
     // separation
     v2f_t norm_separation = safe_v2f_div(update.separation, v2ff(v2f_len(update.separation)));
@@ -227,14 +1903,11 @@ static boid_update_t calculate_deltas(boid_t boid, qtree_t *qtree) {
   return update;
 }
 
-static v2f_t calculate_acceleration(boid_update_t deltas) {
-  float separation_scale = 2.0;
-  float alignment_scale = 2.0;
-  float cohesion_scale = 3.0;
-  // scale deltas (for customizing behaviour), default is a noop
-  v2f_t sep = v2f_mul(deltas.separation, v2ff(separation_scale));
-  v2f_t ali = v2f_mul(deltas.alignment, v2ff(alignment_scale));
-  v2f_t coh = v2f_mul(deltas.cohesion, v2ff(cohesion_scale));
+static v2f_t calculate_acceleration(boid_update_t deltas, const simulation_config_t *config) {
+  // scale deltas (for customizing behaviour), a scale of 1.0 is a noop
+  v2f_t sep = v2f_mul(deltas.separation, v2ff(config->separation_scale));
+  v2f_t ali = v2f_mul(deltas.alignment, v2ff(config->alignment_scale));
+  v2f_t coh = v2f_mul(deltas.cohesion, v2ff(config->cohesion_scale));
   return v2f_add(sep, v2f_add(ali, coh));
 }
 
@@ -261,17 +1934,184 @@ static bool boid_in_range(void *ele, rect_t range) {
   return rect_contains_point(range, boid->position);
 }
 
+static v2f_t boid_point(void *ele) {
+  assert(ele != NULL);
+  boid_t *boid = (boid_t *) ele;
+  return boid->position;
+}
+
+static v2f_t boid_ref_point(void *ele) {
+  assert(ele != NULL);
+  boid_t *boid = *(boid_t **) ele;
+  return boid->position;
+}
+
+static v2f_t origin_point(void *ele) {
+  assert(ele != NULL);
+  return *(v2f_t *) ele;
+}
+
+static v2f_t boid_velocity(void *ele) {
+  assert(ele != NULL);
+  boid_t *boid = (boid_t *) ele;
+  return boid->velocity;
+}
+
+static v2f_t boid_position(const boid_t *boid) {
+  return boid->position;
+}
+
 static void chunk_boid_update(void *arg) {
   assert(arg != NULL);
   boid_chunk_task_t *task = (boid_chunk_task_t *)arg;
-  boid_t *buffer = task->buffer;
-  boid_t *swap = task->swap;
-  size_t start = task->start;
-  size_t end = task->end;
-  qtree_t *qtree = task->qtree;
-  float dt = task->dt;
 
-  for (size_t i = start; i < end; ++i) {
-    update_boid_into_swap(&swap[i], buffer[i], qtree, dt);
+  if (task->list_part != NULL) {
+    build_lists(task);
+    return;
+  }
+
+  if (task->cursor == NULL) {
+    update_range(task, task->start, task->end);
+    return;
+  }
+
+  if (task->leaves != NULL) {
+    for (;;) {
+      size_t leaf = atomic_fetch_add(task->cursor, 1);
+      if (leaf >= task->end) break;
+      update_leaf(task, task->leaves[leaf]);
+    }
+    return;
+  }
+
+  // keep claiming small chunks until the cursor runs past our end
+  for (;;) {
+    size_t start = atomic_fetch_add(task->cursor, DYNAMIC_GRAIN);
+    if (start >= task->end) break;
+    size_t end = start + DYNAMIC_GRAIN;
+    if (end > task->end) end = task->end;
+    update_range(task, start, end);
+  }
+}
+
+static void chunk_pair_accumulate(void *arg) {
+  assert(arg != NULL);
+  boid_pair_task_t *task = (boid_pair_task_t *)arg;
+
+  for (;;) {
+    size_t row = 2*atomic_fetch_add(task->cursor, 1) + task->parity;
+    if (row >= task->grid->rows) break;
+    accumulate_row(task, row);
+  }
+}
+
+static void chunk_qtree_build(void *arg) {
+  assert(arg != NULL);
+  qtree_build_task_t *task = (qtree_build_task_t *)arg;
+  size_t worker = tpool_worker_index();
+  assert(worker != TPOOL_NO_WORKER);
+  simulation_scratch_t *scratch = &task->scratch[worker];
+  arena_t *arena = task->persist ? &scratch->tree_arena : &scratch->arena;
+
+  if (task->depth >= BUILD_DEPTH || task->len <= BUILD_MIN_LEN) {
+    // small enough, just insert in order
+    for (size_t i = 0; i < task->len; ++i) {
+      qtree_insert(task->qtree, arena, task->eles[i]);
+    }
+    return;
+  }
+
+  size_t child_lens[4] = {0};
+  if (!qtree_split(task->qtree, arena, task->eles, task->len, task->spare, child_lens)) {
+    // everything fit in this node
+    return;
+  }
+
+  qtree_t *children[4] = {task->qtree->ne, task->qtree->se, task->qtree->sw, task->qtree->nw};
+  size_t offset = 0;
+  for (size_t c = 0; c < 4; ++c) {
+    if (child_lens[c] > 0) {
+      // children read what we grouped into spare, and may clobber our eles
+      qtree_build_task_t *child = arena_alloc(arena, sizeof(qtree_build_task_t));
+      assert(child != NULL);
+      child->pool = task->pool;
+      child->scratch = task->scratch;
+      child->qtree = children[c];
+      child->eles = task->spare + offset;
+      child->spare = task->eles + offset;
+      child->len = child_lens[c];
+      child->depth = task->depth + 1;
+      child->persist = task->persist;
+      tpool_add_work(task->pool, chunk_qtree_build, child);
+    }
+    offset += child_lens[c];
+  }
+}
+
+static void chunk_boid_qtree_build(void *arg) {
+  assert(arg != NULL);
+  boid_qtree_build_task_t *task = (boid_qtree_build_task_t *)arg;
+  size_t worker = tpool_worker_index();
+  assert(worker != TPOOL_NO_WORKER);
+  arena_t *arena = &task->scratch[worker].arena;
+
+  if (task->depth >= BUILD_DEPTH || task->len <= BUILD_MIN_LEN) {
+    for (size_t i = 0; i < task->len; ++i) {
+      boid_qtree_insert(task->qtree, arena, task->eles[i]);
+    }
+    return;
   }
-}
\ No newline at end of file
+
+  size_t child_lens[4] = {0};
+  if (!boid_qtree_split(task->qtree, arena, task->eles, task->len, task->spare, child_lens)) {
+    return;
+  }
+
+  boid_qtree_t *children[4] = {task->qtree->ne, task->qtree->se, task->qtree->sw, task->qtree->nw};
+  size_t offset = 0;
+  for (size_t c = 0; c < 4; ++c) {
+    if (child_lens[c] > 0) {
+      boid_qtree_build_task_t *child = arena_alloc(arena, sizeof(boid_qtree_build_task_t));
+      assert(child != NULL);
+      child->pool = task->pool;
+      child->scratch = task->scratch;
+      child->qtree = children[c];
+      child->eles = task->spare + offset;
+      child->spare = task->eles + offset;
+      child->len = child_lens[c];
+      child->depth = task->depth + 1;
+      tpool_add_work(task->pool, chunk_boid_qtree_build, child);
+    }
+    offset += child_lens[c];
+  }
+}
+
+bool simulation_parse_size(const char *value, size_t *out) {
+  // strtoull would skip leading space and take a sign (wrapping "-5" around)
+  if (!isdigit((unsigned char) value[0])) return false;
+  char *end = NULL;
+  errno = 0;
+  unsigned long long parsed = strtoull(value, &end, 10);
+  if (*end != '\0' || errno == ERANGE || parsed > SIZE_MAX) return false;
+  *out = (size_t) parsed;
+  return true;
+}
+
+bool simulation_parse_float(const char *value, float *out) {
+  char *end = NULL;
+  float parsed = strtof(value, &end);
+  if (end == value || *end != '\0') return false;
+  *out = parsed;
+  return true;
+}
+
+static bool parse_bool(const char *value, bool *out) {
+  if (strcmp(value, "0") == 0) {
+    *out = false;
+  } else if (strcmp(value, "1") == 0) {
+    *out = true;
+  } else {
+    return false;
+  }
+  return true;
+}
@@ -2,6 +2,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <stdatomic.h>
 
 #include "tpool.h"
 
@@ -12,10 +13,25 @@ typedef struct work {
   struct work *next;
 } work_t;
 
+/// A thread's own queue of work (TPOOL_MODE_STEALING), a growable ring buffer;
+/// the owner pushes and pops at the bottom while thieves take from the top
+typedef struct deque {
+  pthread_mutex_t mutex;
+  work_t *items;
+  size_t capacity;
+  // items[top..bottom] (mod capacity) holds queued work
+  size_t top;
+  size_t bottom;
+} deque_t;
+
+#define DEQUE_DEFAULT_CAPACITY (64)
+
 struct tpool {
   // doubly linked work queue
   work_t *work_first;
   work_t *work_last;
+  // finished work kept around for reuse, so steady state submits never malloc
+  work_t *work_spare;
   pthread_mutex_t work_queue_mutex;
   // signals the threads that there is work to be processed
   pthread_cond_t worker_cond;
@@ -25,25 +41,68 @@ struct tpool {
   size_t working_cnt;
   // track number of alive threads
   size_t thread_cnt;
+  // hand out worker indices as threads start
+  size_t worker_cnt;
   bool stop;
+
+  // only used with TPOOL_MODE_STEALING, where the queue above stays empty
+  tpool_mode_t mode;
+  size_t deque_cnt;
+  deque_t *deques;
+  // work sitting in deques, and work either queued or running
+  atomic_size_t queued_cnt;
+  atomic_size_t pending_cnt;
+  // threads asleep on worker_cond
+  atomic_size_t sleeping_cnt;
+  // round robin over deques for work submitted from outside the pool
+  atomic_size_t next_deque;
 };
 
-/// Initialize some unit of work to perform with a given task and data
-static work_t *work_init(thread_func_t func, void *arg);
+/// Index of the pool thread we are running on (see tpool_worker_index)
+static _Thread_local size_t worker_index = TPOOL_NO_WORKER;
+
+/// Initialize some unit of work to perform with a given task and data, reusing
+/// a spare unit of work if there is one (need exclusive access)
+static work_t *work_init(tpool_t *tp, thread_func_t func, void *arg);
 /// Free the memory of some unit of work
 static void work_free(work_t *work);
+/// Return some unit of work to the spares for reuse (need exclusive access)
+static void work_release(tpool_t *tp, work_t *work);
 /// Extract a chunk of work from tpool (need exclusive access)
 static work_t *work_get(tpool_t *tp);
 /// A perpetually running thread that manages work extraction and execution,
 /// returns no data but must match thread_func_t signature
 static void *worker(void *arg);
+/// Same as worker, but running work from its own deque or stolen from others
+static void *stealing_worker(void *arg);
+/// Add some unit of work to a deque (TPOOL_MODE_STEALING)
+static bool stealing_add_work(tpool_t *tp, thread_func_t func, void *arg);
+/// Wait for all work to finish, or all threads to exit once stopped
+static void stealing_wait(tpool_t *tp);
+/// Take work from our own deque, or steal from another, returning success
+static bool stealing_take(tpool_t *tp, size_t self, work_t *out);
+/// Initialize an empty deque
+static void deque_init(deque_t *deque);
+/// Free a deque and any work left in it
+static void deque_free(deque_t *deque);
+/// Push work onto the bottom of a deque (need exclusive access)
+static void deque_push(deque_t *deque, work_t work);
+/// Pop the newest work off the bottom of a deque (need exclusive access)
+static bool deque_pop_bottom(deque_t *deque, work_t *out);
+/// Pop the oldest work off the top of a deque (need exclusive access)
+static bool deque_pop_top(deque_t *deque, work_t *out);
 
 tpool_t *tpool_new(size_t num) {
+  return tpool_new_mode(num, TPOOL_MODE_SHARED);
+}
+
+tpool_t *tpool_new_mode(size_t num, tpool_mode_t mode) {
   if (num == 0) num = 2;
 
   // init self
   tpool_t *tp = calloc(1, sizeof(*tp));
   tp->thread_cnt = num;
+  tp->mode = mode;
 
   // init sync objects
   pthread_mutex_init(&tp->work_queue_mutex, NULL);
@@ -53,11 +112,26 @@ tpool_t *tpool_new(size_t num) {
   // init queue
   tp->work_first = NULL;
   tp->work_last = NULL;
+  tp->work_spare = NULL;
+
+  // init deques, one per thread
+  atomic_init(&tp->queued_cnt, 0);
+  atomic_init(&tp->pending_cnt, 0);
+  atomic_init(&tp->sleeping_cnt, 0);
+  atomic_init(&tp->next_deque, 0);
+  if (mode == TPOOL_MODE_STEALING) {
+    tp->deque_cnt = num;
+    tp->deques = calloc(num, sizeof(deque_t));
+    assert(tp->deques != NULL);
+    for (size_t i = 0; i < num; i++) {
+      deque_init(&tp->deques[i]);
+    }
+  }
 
   // create worker threads
   pthread_t thread;
   for (size_t i = 0; i < num; i++) {
-    pthread_create(&thread, NULL, worker, tp);
+    pthread_create(&thread, NULL, mode == TPOOL_MODE_STEALING ? stealing_worker : worker, tp);
     // BUG: valgrind might not catch some deallocated threads after main exits
     pthread_detach(thread);
   }
@@ -68,6 +142,11 @@ tpool_t *tpool_new(size_t num) {
 void tpool_free(tpool_t *tp) {
   assert(tp != NULL);
 
+  if (tp->mode == TPOOL_MODE_STEALING) {
+    // let outstanding work finish before asking threads to exit
+    stealing_wait(tp);
+  }
+
   // mutex zone
   {
     pthread_mutex_lock(&tp->work_queue_mutex);
@@ -88,6 +167,20 @@ void tpool_free(tpool_t *tp) {
 
   tpool_wait(tp);
 
+  // every thread has exited, nobody else can touch the spares now
+  work_t *spare = tp->work_spare;
+  while (spare != NULL) {
+    work_t *spare_next = spare->next;
+    work_free(spare);
+    spare = spare_next;
+  }
+  tp->work_spare = NULL;
+
+  for (size_t i = 0; i < tp->deque_cnt; i++) {
+    deque_free(&tp->deques[i]);
+  }
+  free(tp->deques);
+
   pthread_mutex_destroy(&tp->work_queue_mutex);
   pthread_cond_destroy(&tp->worker_cond);
   pthread_cond_destroy(&tp->working_cond);
@@ -97,13 +190,20 @@ void tpool_free(tpool_t *tp) {
 
 bool tpool_add_work(tpool_t *tp, thread_func_t func, void *arg) {
   assert(tp != NULL);
+  if (func == NULL) return false;
 
-  work_t *work = work_init(func, arg);
-  if (work == NULL) return false;
+  if (tp->mode == TPOOL_MODE_STEALING) {
+    return stealing_add_work(tp, func, arg);
+  }
 
   // mutex zone
   {
     pthread_mutex_lock(&tp->work_queue_mutex);
+    work_t *work = work_init(tp, func, arg);
+    if (work == NULL) {
+      pthread_mutex_unlock(&tp->work_queue_mutex);
+      return false;
+    }
     // is queue empty?
     if (tp->work_first == NULL) {
       // add as first
@@ -129,6 +229,11 @@ bool tpool_add_work(tpool_t *tp, thread_func_t func, void *arg) {
 void tpool_wait(tpool_t *tp) {
   assert(tp != NULL);
 
+  if (tp->mode == TPOOL_MODE_STEALING) {
+    stealing_wait(tp);
+    return;
+  }
+
   // mutex zone
   {
     pthread_mutex_lock(&tp->work_queue_mutex);
@@ -152,10 +257,19 @@ void tpool_wait(tpool_t *tp) {
   }
 }
 
-static work_t *work_init(thread_func_t func, void *arg) {
+size_t tpool_worker_index(void) {
+  return worker_index;
+}
+
+static work_t *work_init(tpool_t *tp, thread_func_t func, void *arg) {
   if (func == NULL) return NULL;
-  work_t *work;
-  work = malloc(sizeof(*work));
+  work_t *work = tp->work_spare;
+  if (work != NULL) {
+    tp->work_spare = work->next;
+  } else {
+    work = malloc(sizeof(*work));
+    if (work == NULL) return NULL;
+  }
   work->func = func;
   work->arg = arg;
   work->next = NULL;
@@ -166,6 +280,11 @@ static void work_free(work_t *work) {
   free(work);
 }
 
+static void work_release(tpool_t *tp, work_t *work) {
+  work->next = tp->work_spare;
+  tp->work_spare = work;
+}
+
 static work_t *work_get(tpool_t *tp) {
   assert(tp != NULL);
 
@@ -190,6 +309,11 @@ static void *worker(void *arg) {
   assert(arg != NULL);
   tpool_t *tp = arg;
 
+  // claim an index for this thread
+  pthread_mutex_lock(&tp->work_queue_mutex);
+  worker_index = tp->worker_cnt++;
+  pthread_mutex_unlock(&tp->work_queue_mutex);
+
   for (;;) {
     work_t *work;
     // mutex zone
@@ -207,16 +331,18 @@ static void *worker(void *arg) {
       pthread_mutex_unlock(&tp->work_queue_mutex);
     }
 
-    // try to run worker task on thread after releasing lock, freeing worker
-    // upon completion
+    // try to run worker task on thread after releasing lock, recycling the
+    // work upon completion
     if (work != NULL) {
       work->func(work->arg);
-      work_free(work);
     }
 
     // mutex zone
     {
       pthread_mutex_lock(&tp->work_queue_mutex);
+      if (work != NULL) {
+        work_release(tp, work);
+      }
       // worker finished above, decrement count
       tp->working_cnt--;
       // check if no threads are working, sending signal to threads waiting
@@ -238,3 +364,166 @@ static void *worker(void *arg) {
 
   return NULL;
 }
+
+static bool stealing_add_work(tpool_t *tp, thread_func_t func, void *arg) {
+  work_t work = { .func = func, .arg = arg, .next = NULL };
+
+  // keep work submitted by a pool thread local to it, spread everything else
+  size_t target = worker_index;
+  if (target >= tp->deque_cnt) {
+    target = atomic_fetch_add(&tp->next_deque, 1) % tp->deque_cnt;
+  }
+
+  // pending before queued, so pending never reads lower than queued
+  atomic_fetch_add(&tp->pending_cnt, 1);
+
+  deque_t *deque = &tp->deques[target];
+  pthread_mutex_lock(&deque->mutex);
+  deque_push(deque, work);
+  pthread_mutex_unlock(&deque->mutex);
+
+  atomic_fetch_add(&tp->queued_cnt, 1);
+
+  // only touch the shared lock if somebody is asleep; a thread going to sleep
+  // either sees our queued work or is seen by us (both sides are seq_cst)
+  if (atomic_load(&tp->sleeping_cnt) > 0) {
+    pthread_mutex_lock(&tp->work_queue_mutex);
+    pthread_cond_signal(&tp->worker_cond);
+    pthread_mutex_unlock(&tp->work_queue_mutex);
+  }
+
+  return true;
+}
+
+static void stealing_wait(tpool_t *tp) {
+  // mutex zone
+  {
+    pthread_mutex_lock(&tp->work_queue_mutex);
+    for (;;) {
+      // is there work queued or running while alive?
+      // is it stopped with living threads?
+      bool still_waiting = (!tp->stop && atomic_load(&tp->pending_cnt) != 0) ||
+                           (tp->stop && tp->thread_cnt != 0);
+      if (!still_waiting) break;
+      pthread_cond_wait(&tp->working_cond, &tp->work_queue_mutex);
+    }
+    pthread_mutex_unlock(&tp->work_queue_mutex);
+  }
+}
+
+static bool stealing_take(tpool_t *tp, size_t self, work_t *out) {
+  // newest work of our own first, it is the most likely to be cache hot
+  deque_t *own = &tp->deques[self];
+  pthread_mutex_lock(&own->mutex);
+  bool found = deque_pop_bottom(own, out);
+  pthread_mutex_unlock(&own->mutex);
+
+  // otherwise steal the oldest work of someone else, likely the largest
+  for (size_t i = 1; !found && i < tp->deque_cnt; i++) {
+    deque_t *victim = &tp->deques[(self + i) % tp->deque_cnt];
+    pthread_mutex_lock(&victim->mutex);
+    found = deque_pop_top(victim, out);
+    pthread_mutex_unlock(&victim->mutex);
+  }
+
+  if (found) {
+    atomic_fetch_sub(&tp->queued_cnt, 1);
+  }
+  return found;
+}
+
+static void *stealing_worker(void *arg) {
+  assert(arg != NULL);
+  tpool_t *tp = arg;
+
+  // claim an index (and with it a deque) for this thread
+  pthread_mutex_lock(&tp->work_queue_mutex);
+  worker_index = tp->worker_cnt++;
+  pthread_mutex_unlock(&tp->work_queue_mutex);
+
+  for (;;) {
+    work_t work;
+    if (stealing_take(tp, worker_index, &work)) {
+      work.func(work.arg);
+      // last piece of outstanding work, wake up tpool_wait
+      if (atomic_fetch_sub(&tp->pending_cnt, 1) == 1) {
+        pthread_mutex_lock(&tp->work_queue_mutex);
+        pthread_cond_broadcast(&tp->working_cond);
+        pthread_mutex_unlock(&tp->work_queue_mutex);
+      }
+      continue;
+    }
+
+    // nothing anywhere, sleep until work is added or we are stopped
+    pthread_mutex_lock(&tp->work_queue_mutex);
+    // stop if requested, ***still holding lock*** (only way to exit the loop)
+    if (tp->stop) break;
+    atomic_fetch_add(&tp->sleeping_cnt, 1);
+    if (atomic_load(&tp->queued_cnt) == 0) {
+      pthread_cond_wait(&tp->worker_cond, &tp->work_queue_mutex);
+    }
+    atomic_fetch_sub(&tp->sleeping_cnt, 1);
+    pthread_mutex_unlock(&tp->work_queue_mutex);
+  }
+
+  // technically still in mutex zone
+
+  // this thread is done, decrement thread count
+  tp->thread_cnt--;
+  // signal tpool_wait that a thread has exited
+  pthread_cond_signal(&tp->working_cond);
+  // unlock mutex after stopping
+  pthread_mutex_unlock(&tp->work_queue_mutex);
+
+  return NULL;
+}
+
+static void deque_init(deque_t *deque) {
+  pthread_mutex_init(&deque->mutex, NULL);
+  deque->capacity = DEQUE_DEFAULT_CAPACITY;
+  deque->items = calloc(deque->capacity, sizeof(work_t));
+  assert(deque->items != NULL);
+  deque->top = 0;
+  deque->bottom = 0;
+}
+
+static void deque_free(deque_t *deque) {
+  pthread_mutex_destroy(&deque->mutex);
+  free(deque->items);
+  deque->items = NULL;
+  deque->capacity = 0;
+}
+
+static void deque_push(deque_t *deque, work_t work) {
+  size_t len = deque->bottom - deque->top;
+  if (len == deque->capacity) {
+    // full, unroll the ring into a buffer twice the size
+    size_t capacity = 2*deque->capacity;
+    work_t *items = calloc(capacity, sizeof(work_t));
+    assert(items != NULL);
+    for (size_t i = 0; i < len; i++) {
+      items[i] = deque->items[(deque->top + i) % deque->capacity];
+    }
+    free(deque->items);
+    deque->items = items;
+    deque->capacity = capacity;
+    deque->top = 0;
+    deque->bottom = len;
+  }
+  deque->items[deque->bottom % deque->capacity] = work;
+  deque->bottom++;
+}
+
+static bool deque_pop_bottom(deque_t *deque, work_t *out) {
+  if (deque->bottom == deque->top) return false;
+  deque->bottom--;
+  *out = deque->items[deque->bottom % deque->capacity];
+  return true;
+}
+
+static bool deque_pop_top(deque_t *deque, work_t *out) {
+  if (deque->bottom == deque->top) return false;
+  *out = deque->items[deque->top % deque->capacity];
+  deque->top++;
+  return true;
+}
\ No newline at end of file